@@ -1,861 +1,5015 @@
-/**
- * @file
- *
- * Explores memory management at the C runtime level.
- *
- * To use (one specific command):
- * LD_PRELOAD=$(pwd)/allocator.so command
- * ('command' will run with your allocator)
- *
- * To use (all following commands):
- * export LD_PRELOAD=$(pwd)/allocator.so
- * (Everything after this point will use your custom allocator -- be careful!)
- */
-
-#include <pthread.h>
-#include <stdbool.h>
-#include <stdint.h>
-#include <stdio.h>
-#include <string.h>
-#include <sys/mman.h>
-#include <unistd.h>
-#include <sys/mman.h>
-#include <fcntl.h>
-#include <stdlib.h>
-#include <limits.h>
-
-#include "allocator.h"
-#include "logger.h"
-
-#define BLOCK_ALIGN 8
-
-static struct mem_block *g_head = NULL; /*!< Start (head) of our linked list */
-static struct mem_block *g_tail = NULL;
-
-static unsigned long g_regions = 0; /*!< Allocation counter */
-pthread_mutex_t alloc_mutex = PTHREAD_MUTEX_INITIALIZER; /*< Mutex for protecting the linked list */
-
-static int g_allocations = 0;
-
-
-
-/* Func protoyptes */
-void ll_log_block(struct mem_block *block);
-void ll_log_list();
-void ll_add(struct mem_block *prev_block, struct mem_block *new_block);
-void ll_delete(struct mem_block *block);
-
-bool blocks_can_merge(struct mem_block *block, struct mem_block *neighbor);
-
-int try_to_expand_block_into(struct mem_block *head, struct mem_block *next, size_t size);
-
-void *get_data_from_header(struct mem_block *header);
-struct mem_block *get_header_from_data(void *data);
-
-size_t get_diff(size_t first, size_t second);
-
-void scribble_if_requested(struct mem_block *block, size_t real_size);
-
-struct mem_block *map_new_region(size_t real_size);
-
-
-/**
- * @brief      If able, expands a used block into next block. Else, does nothing
- *
- * @param      head  used block
- * @param      next  block right after head
- * @param      size  requested size
- * 
- * @return     0 if can't merge, 1 if it can and did
- */
-int try_to_expand_block_into(struct mem_block *head, struct mem_block *next, size_t size)
-{
-    if (!blocks_can_merge(head, next) || head->size + next->size < size) {
-        return 0;
-    }
-
-    head->size += next->size;
-    ll_delete(next);
-    return 1;
-}
-
-/**
- * @brief      Tells whether a given block is the only one in its region (i.e. its neighbors have different region ids)
- *
- * @param      block  block
- *
- * @return     True if block is the only one in its region. Else, false
- */
-bool is_only_block_in_region(struct mem_block *block)
-{
-    struct mem_block* prev = block->prev;
-    struct mem_block* next = block->next;
-
-    bool no_prev_neighbors = prev == NULL || prev->region_id != block->region_id;
-    bool no_next_neighbors = next == NULL || next->region_id != block->region_id;
-
-    return no_prev_neighbors && no_next_neighbors;
-}
-
-/**
- * @brief      Given a header, returns the data block associated with it
- *
- * @param      header  header
- *
- * @return     data block associated with header
- */
-void *get_data_from_header(struct mem_block *header)
-{
-    return header != NULL ? header + 1 : NULL;
-}
-
-/**
- * @brief      Given a block of data, returns the header associated with it
- *
- * @param      data  data block
- *
- * @return     header associated with data block
- */
-struct mem_block *get_header_from_data(void *data)
-{
-    return data != NULL ? (struct mem_block *)data - 1 : NULL;
-}
-
-/**
- * @brief      Gets total_size, aligned to be divisble by 8, to work with certain architectures
- *
- * @param[in]  total_size  total size
- *
- * @return     total_size, increased until it is divisible by 8
- */
-size_t get_aligned_size(size_t total_size)
-{
-    return total_size % BLOCK_ALIGN == 0 ? total_size :
-        total_size + (BLOCK_ALIGN - (total_size % BLOCK_ALIGN));
-}
-
-/**
- * @brief      Gets size of a new region
- *
- * @param[in]  real_size  size of data block + size of header
- *
- * @return     real_size, increased until it is divisible by getpagesize() (as of time
- *              of this writing, 4096)
- */
-size_t get_region_size(size_t real_size)
-{
-    int page_size = getpagesize();
-
-    size_t num_pages = real_size % page_size != 0 ? real_size / page_size + 1 :
-        real_size / page_size;
-
-    return page_size * num_pages;
-}
-
-/**
- * @brief      Adds a block to a block that already exists in a linked list
- *
- * @param      prev_block  block we add new block to
- * @param      new_block   block we add to linked list
- */
-void ll_add(struct mem_block *prev_block, struct mem_block *new_block)
-{
-
-
-    sprintf(new_block->name, "New block %d", g_allocations + 1);
-    ll_log_block(prev_block);
-    ll_log_block(new_block);
-
-    LOGP("BOOKMARK\n");
-    struct mem_block *next_block;
-
-    if (new_block == NULL || prev_block == NULL || new_block == prev_block->next) {
-        LOGP("RETURNING\n");
-        return;
-    }
-
-    if (prev_block != NULL && new_block != NULL) {
-        next_block = prev_block->next;
-        prev_block->next = new_block;
-        new_block->prev = prev_block;
-
-    }
-
-    if (new_block != NULL && next_block != NULL) {
-        next_block->prev = new_block;
-        new_block->next = next_block;
-    }
-
-    LOGP("DONE\n");
-    ll_log_block(prev_block);
-
-
-
-
-
-}
-
-/**
- * @brief      Deletes a block from the linked list, updating g_head and g_tail as needed
- *
- * @param      block  block we will delete
- */
-void ll_delete(struct mem_block *block) {
-
-    if (block == NULL) {
-        return;
-    }
-
-    struct mem_block* prev = block->prev;
-    struct mem_block* next = block->next;
-
-    // Case: prev exists - link prev w/ next
-    if (prev != NULL) {
-        prev->next = next;    
-    }
-    // Case: next exists - link next w/ prev
-    if (next != NULL) {
-        next->prev = prev;    
-    }
-    // Case: block was g_tail - make g_tail = prev
-    if (block == g_tail) {
-        g_tail = prev;
-    }
-
-    // Case: block was g_head - make g_head = next
-    if (block == g_head) {
-        g_head = next;
-    }
-}
-
-/**
- * @brief      Logs info from a given block
- *
- * @param      block  memory block
- * 
- * @note       Warning: Useful but segfaults often - if there are segfaults in code, might want
- *              to comment out calls to this func first
- */
-void ll_log_block(struct mem_block *block) {
-
-    if (block == NULL) {
-        LOGP("NULL BLOCK\n");
-        return;
-    }
-    LOG(" %p <----- %p -----> %p\n", block->prev, block, block->next);
-
-    LOG(" '%s' <----- '%s' -----> '%s'\n",
-        block->prev != NULL ? block->prev->name : "NULL BLOCK",
-        block->name,
-        block->next != NULL ? block->next->name: "NULL BLOCK");
-
-    if (block->next != NULL && strcmp(block->next->name, "Test Allocation: 4") == 0) {
-        LOGP("4TH ALLOCATION DETECTED\n");
-        LOG("\t----->'%s'\n", block->next->next->name);
-    }
-    LOGP("\n");
-}
-
-/**
- * @brief      Logs info from the whole linked list
- * 
- * @note       Not using ll_log_block to avoid segfaults
- */
-void ll_log_list() {
-
-    LOG("STARITNG FROM HEAD: %p '%s'------------------------------------------------------------------------------------------------->\n", g_head, g_head != NULL ? g_head->name : "NULL BLOCK");
-    struct mem_block *current = g_head;
-
-    while (current != NULL) {
-        LOG("%p -----> %p\n", current, current->next);
-        LOG("'%s' -----> '%s'\n\n", current->name, current->next != NULL ? current->next->name : "NULL BLOCK");
-       current = current->next;
-    }
-}
-
-
-
-
-/**
- * @brief      Given a free block, this function will split it into two pieces and update
- *              the linked list.
- *
- * @param      block  the block to split
- * @param[in]  size   new size of the first block after the split is complete,
- *                      including header sizes. The size of the second block will be the original
- *                      block's size minus this parameter.
- *
- * @return     address of the resulting second block (the original address will be
- *              unchanged) or NULL if the block cannot be split.
- *              
- * @note       This description is from Prof. Matthew. The only change is that it's been reformatted.
- *              Also, size includes header size
- */
-struct mem_block *split_block(struct mem_block *block, size_t size)
-{
-    size_t min_sz = sizeof(struct mem_block) + BLOCK_ALIGN;
-
-    if (size < min_sz || block == NULL || !block->free) {
-        LOGP("INVALID - RETURNING NULL\n");
-        return NULL;
-    }
-    if (block->size - size < min_sz) {
-        LOG("NEW BLOCK WOULD BE SIZE: %zu - too small returning null\n", block->size - size);
-        return NULL;
-    }
-
-    struct mem_block* leftover_data_header = (struct mem_block *) ( (char *)block + size  );
-
-    leftover_data_header->free = true;
-    leftover_data_header->prev = NULL;
-    leftover_data_header->next = NULL;
-    leftover_data_header->region_id = block->region_id;
-    leftover_data_header->size = block->size - size;
-
-    /* REGION: Change size of block */
-    block->size = size;
-
-    /* REGION: Update linked list and tail */
-    ll_add(block, leftover_data_header);
-
-    if (block == g_tail) {
-        g_tail = leftover_data_header;
-        g_tail->next = NULL;
-    }
-
-    return leftover_data_header;
-}
-
-/**
- * Given a free block, this function attempts to merge it with neighboring
- * blocks --- both the previous and next neighbors --- and update the linked
- * list accordingly.
- *
- * @param block the block to merge
- *
- * @return address of the merged block or NULL if the block cannot be merged.
- */
-
-/**
- * @brief       Given a free block, this function attempts to merge it with neighboring
-                blocks --- both the previous and next neighbors --- and update the linked
-                list accordingly.
- *
- * @param      block  the block to merge
- *
- * @return     address of the merged block or NULL if the block cannot be merged.
- *
- * @note       Again Prof. Matthew's words, reformatted
- */
-struct mem_block *merge_block(struct mem_block *block)
-{
-    struct mem_block* header = block;
-
-    if (blocks_can_merge(block, block->next)) {
-        block->size += block->next->size;
-        ll_delete(block->next);
-    }
-
-    if (blocks_can_merge(block, block->prev)) {
-        header = block->prev;
-
-        block->prev->size += block->size;
-        ll_delete(block);
-    }
-
-    return header;
-}
-
-/* Returns true if the following are true:
-    1. neighbor exists
-    2. neighbor and block have same region ids
-    3. block and neighbor are both free (will instantly return false if block is not free)
-
-    Else, returns false
-    */
-
-/**
- * @brief      Returns true if the following are true:
- *              1. neighbor exists
- *              2. neighbor and block have same region ids
- *              3. neighbor and block are both free 
- *
- * @param      block     block
- * @param      neighbor  neighboring block (will check in function to make sure this is the case)
- *
- * @return     true if the above conditions are all true, else false
- */
-bool blocks_can_merge(struct mem_block *block, struct mem_block *neighbor) {
-
-    if (!block->free) {
-       LOG("ERROR - BLOCK IS USED: '%s' - returning immediately\n", !block->free ? "USED" : "FREE");
-       return false;
-    }
-
-    if (block->next != neighbor && block->prev != neighbor) {
-        LOGP("ERROR - NOT NEIGHBORS - RETURNING FALSE\n");
-        return false;
-    }
-
-    return neighbor != NULL && block->region_id == neighbor->region_id && neighbor->free;
-}
-
-/**
- * @brief      Returns absolute difference between first and second
- *
- * @param[in]  first   size value
- * @param[in]  second  other size value
- *
- * @return     absolute difference between first and second
- */
-size_t get_diff(size_t first, size_t second)
-{
-    return abs( (ssize_t)first - (ssize_t)second );
-
-}
-
-/**
- * Given a block size (header + data), locate a suitable location using the
- * first fit free space management algorithm.
- *
- * @param size size of the block (header + data)
- */
-/**
- * @brief      Given a block size (header + data), locate a suitable location using the
- *              first fit free space management algorithm.
- *
- * @param[in]  size  size of the block (header + data)
- *
- * @return     First matching block, or NULL if no match
- * 
- * @note       brief and params are Prof. Matthew's words. Same with best_fit and worst_fit. Also Prof. Matthew's words: "If you get segfault here - probably something else is wrong"
- */
-void *first_fit(size_t size)
-{
-    LOGP("START FIRST_FIT------------------------------------------------------------------\n");
-    struct mem_block *current = g_head;
-
-    while (current != NULL) {
-        // Case: found match - return header
-
-        //ll_log_block(current);
-
-
-
-        LOG("%p ['%s'] -----> %p ['%s']\n", current, current->free ? "FREE" : "USED", current->next, current->next != NULL && current->next->free ? "FREE" : "USED OR NULL");
-
-        LOG("'%s' -----> '%s'\n", current->name, current->next != NULL ? current->next->name : "NULL BLOCK");
-
-        if (current->prev != NULL && current->prev->prev != NULL && current->prev->prev->prev != NULL) {
-           /*
-            LOG("STUUUUUUUUUUUUF: %p <-- %p <-- %p <-- %p\n", current->prev->prev->prev, current->prev->prev, current->prev, current);
-            LOG("STUUUUUUUUUUUUF: '%s' <-- '%s' <-- '%s' <-- '%s'\n", current->prev->prev->prev->name, current->prev->prev->name, current->prev->name, current->name);
-
-            LOG("BUT FORWARD NOW: %p --> %p --> %p --> %p\n",
-                current->prev->prev->prev, current->prev->prev->prev->next, current->prev->prev->prev->next->next, current->prev->prev->prev->next->next->next);
-
-            LOG("BUT FORWARD NOW: '%s' --> '%s' --> '%s' --> '%s'\n________________________________________________________________________________________________________________________________________________________________\n",
-                current->prev->prev->prev->name, current->prev->prev->prev->next->name, current->prev->prev->prev->next->next->name, current->prev->prev->prev->next->next->next->name);
-        
-            LOGP("PREV->PREV->PREV\n");
-            ll_log_block(current->prev->prev->prev);
-
-            LOGP("PREV->-PREV\n");
-            ll_log_block(current->prev->prev);
-
-            LOGP("PREV->PREV->PREV->NEXT\n");
-            ll_log_block(current->prev->prev->prev->next);
-*/
-        }
-
-
-   
-        if (size <= current->size && current->free) {
-            LOGP("DONE FIRST_FIT------------------------------------------------------------------\n");
-            return current;
-        }
-
-        current = current->next;
-    }
-    // Case: no match - return NULL
-    LOGP("DONE FIRST_FIT------------------------------------------------------------------\n");
-    return NULL;
-}
-
-/**
- * Given a block size (header + data), locate a suitable location using the
- * worst fit free space management algorithm. If there are ties (i.e., you find
- * multiple worst fit candidates with the same size), use the first candidate
- * found.
- *
- * @param size size of the block (header + data)
- */
-
-/**
- * @brief       Given a block size (header + data), locate a suitable location using the
- *              worst fit free space management algorithm. If there are ties (i.e., you find
- *              multiple worst fit candidates with the same size), use the first candidate
- *              found.
- * @param[in]  size  size of the block (header + data)
- *
- * @return     Pointer to worst fitting block
- * 
- * @note       See first_fit note
- */
-void *worst_fit(size_t size)
-{
-    struct mem_block *current = g_head;
-    struct mem_block *worst = NULL;
-
-    size_t worst_delta = 0;
-
-    while (current != NULL) {
-
-        // Case: diff > worst_delta - update worst and worst delta to current and diff
-        if (size <= current->size && current->free) {
-            ssize_t diff = get_diff(current->size, size);
-
-            if (diff > worst_delta) {
-                worst = current;
-                worst_delta = diff;
-            }
-        } 
-
-        current = current->next;
-    }
-
-    return worst;
-}
-
-/**
-
- *
- * @param size size of the block (header + data)
- */
-/**
- * @brief       Given a block size (header + data), locate a suitable location using the
- *              best fit free space management algorithm. If there are ties (i.e., you find
- *              multiple best fit candidates with the same size), use the first candidate
- *              found.
- *
- * @param[in]  size  size of the block (header + data)
- *
- * @return     best fitting header
- * 
- * @note       See first_fit note
- */
-void *best_fit(size_t size)
-{
-    struct mem_block *current = g_head;
-    struct mem_block *best = NULL;
-
-    ssize_t best_delta = INT_MAX;
-
-    while (current != NULL) {
-        if (size <= current->size && current->free) {
-            ssize_t diff = get_diff(current->size, size);
-
-            if (diff < best_delta) {
-                best = current;
-                best_delta = diff;
-            }
-        } 
-
-        current = current->next;
-    }
-
-    return best;
-}
-
-/**
- * @brief      Finds the best-suiting block and returns it, based on what FSM algorithm is being used.
- *
- * @param[in]  size  requested size (includes header)
- *
- * @return     best-suiting block based on FSM algorithm, or NULL if no suitable block
- * 
- * @note       Description based off Prof. Matthew's description of this function
- */
-void *reuse(size_t size)
-{
-    char *algo = getenv("ALLOCATOR_ALGORITHM");
-    if (algo == NULL) {
-        algo = "first_fit";
-    }
-
-    struct mem_block* found = NULL;
-
-    if (strcmp(algo, "first_fit") == 0){
-        found = first_fit(size);
-    }
-    else if (strcmp(algo, "best_fit") == 0) {
-        found = best_fit(size);
-    }
-    else if (strcmp(algo, "worst_fit") == 0) {
-        found = worst_fit(size);
-    }
-
-    // Case: FSM algo found match - initalize leftover data (new_head) and return found
-    if (found != NULL) {
-        struct mem_block* new_head = split_block(found, size); // Note - only split if you actually can split block
-
-        if (new_head != NULL) {
-            new_head->region_id = found->region_id;
-            new_head->free = true;
-            //ll_add(found, new_head);
-        }
-
-        found->free = false;
-        return found;
-    }
-    // Case: No match - return NULL
-    return NULL;
-}
-
-/**
- * @brief      Allocates memory with initalizing. If ALLOCATOR_SCRIBBLE environment var is set to 1, will initalize every byte to
- *              0XAA to, as Apple puts it, "increase the chance that a program making assumptions about newly allocated memory fails" 
- *
- * @param[in]  size  size (not including header)
- *
- * @return     A block of data with its size = size
- */
-void *malloc(size_t size)
-{
-    pthread_mutex_lock(&alloc_mutex);
-    /* Lovingly ripped from lab code */
-
-
-    /* REGION: Get real size */
-    size_t real_size = get_aligned_size(size + sizeof(struct mem_block));
-   
-    /* REGION: REUSING A REGION */
-    // Error - not actually getting anything from reuse()???
-    struct mem_block* reused_block = reuse(real_size);
-
-    if (reused_block != NULL) {
-        LOGP("ba\n");
-        sprintf(reused_block->name, "Allocation %d", g_allocations++);
-        scribble_if_requested(reused_block, real_size);
-        pthread_mutex_unlock(&alloc_mutex);
-
-        return reused_block + 1;
-    }
-
-    struct mem_block *new_block = map_new_region(real_size);
-
-    if (new_block == MAP_FAILED) {
-        perror("mmap");
-    }
-
-    if (g_head == NULL && g_tail == NULL) {
-        g_head = new_block;
-        g_tail = g_head;
-        new_block->prev = NULL;
-    }
-    else {
-        ll_add(g_tail, new_block);
-        g_tail = new_block;
-        g_tail->next = NULL;
-    }
-
-    new_block->region_id = g_regions++;
-    new_block->free = true;
-    new_block->size = get_region_size(real_size);
-    new_block->next = NULL;
-    
-    split_block(new_block, real_size);
-    new_block->free = false;
-
-    scribble_if_requested(new_block, real_size);
-    sprintf(new_block->name, "Allocation %d", g_allocations++);
-    pthread_mutex_unlock(&alloc_mutex);
-    return new_block + 1; // block is the memory header; block + 1 is the actual data
-}
-
-/**
- * @brief      Literally the same as malloc, but writes a custom name in the header
- *
- * @param[in]  size  requested size
- * @param      name  name to write in header
- *
- * @return     Block of data with its size = size
- */
-void *malloc_name(size_t size, char *name)
-{
-    void* block = malloc(size);
-
-    struct mem_block* head = get_header_from_data(block);
-    strcpy(head->name, name);
-
-    return block;
-}
-
-/**
- * @brief      If ALLOCATOR_SCRIBBLE enviornment var is set to 1, sets every byte in block to 0XAA to, as 
- *              Apple puts it in its own scribbler, "increase the chance that programs that make certain
- *              assumptions about uninitialized memory fail"
- *
- * @param      head header of block
- * @param[in]  real_size  real size, including header size
- */
-void scribble_if_requested(struct mem_block *head, size_t real_size)
-{
-    char *scribble = getenv("ALLOCATOR_SCRIBBLE");
-
-    if (scribble != NULL && strcmp(scribble, "1") == 0) {
-        memset(get_data_from_header(head), 0XAA, real_size - sizeof(struct mem_block));
-    }
-}
-
-/**
- * @brief      Maps a new region and returns the start as a header
- *
- * @param[in]  real_size  size, including header size
- *
- * @return     pointer to start/header of mapped region
- */
-struct mem_block *map_new_region(size_t real_size)
-{
-    size_t region_size = get_region_size(real_size);
-    const int prot_flags = PROT_READ | PROT_WRITE;
-    const int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
-
-    return (struct mem_block *) mmap(NULL, region_size, prot_flags, map_flags, -1, 0);
-}
-
-/* Copying extremely helpful diagram from class:
- * 
- * aloocate(50) with header:
- * 
- * [HHHHHHHHHH][XXXXX]
- * |            |
- * |            |
- * |            user wants this pointer - malloc returns ptr to here
- * |
- * mmap returns ptr here
- * 
- */
-
-/**
- * @brief      Does the following things to a block of data:
- *              1. If it's NULL, does nothing
- *              2. Otherwise, sets ->free to true
- *                  2.1. Always attempts to merge neighboring free blocks together
- *                  2.2. If also the only block left in its region, unmaps it
- *
- * @param      ptr   ptr to block of data
- */
-void free(void *ptr)
-{
-    pthread_mutex_lock(&alloc_mutex);
-    if (ptr == NULL) {
-        pthread_mutex_unlock(&alloc_mutex);
-        return;
-    }
-
-    struct mem_block *block = get_header_from_data(ptr);
-    block->free = true;
-
-    merge_block(block); // Attempt to merge block
-
-    if (is_only_block_in_region(block)) { // This should also handle g_head or g_tail change
-        ll_delete(block);
-        munmap(block, block->size);
-    }
-
-    pthread_mutex_unlock(&alloc_mutex);
-}
-
-
-/**
- * @brief      Mallocs, then writes 0's over all of data block
- * @param[in]  nmemb  number of type members being allocated (e.g. array.length() if allocating an array)
- * @param[in]  size   size of each member
- *
- * @return     pointer to block of data
- */
-void *calloc(size_t nmemb, size_t size)
-{
-    void* block = malloc(nmemb * size);
-    memset(block, 0, nmemb * size);
-
-    return block;
-}
-
-/**
- * @brief      Does the following to a pointer to a data block, given a size:
- *              1. If ptr is NULL, runs malloc(size)
- *              2. If size == 0, runs free(ptr)
- *              3. Else:
- *                  3.1. If data block can expand into the next neighboring one (next neighbor must be free), does so
- *                  3.2. IF it can't, mallocs a new block, copies data from old block to new block, and frees old block
- *
- * @param      ptr   pointer to data block
- * @param[in]  size  requested size
- *
- * @return     pointer to processed
- */
-void *realloc(void *ptr, size_t size)
-{
-    LOGP("REALLOC CALLED\n");
-    // Case: ptr is NULL - do malloc(size)
-    if (ptr == NULL) {
-        return malloc(size);
-    }
-    // Case: size == 0 - do free(ptr) 
-    else if (size == 0) {
-        free(ptr);
-        return NULL;
-    }
-
-    // Case: ptr != NULL, size != 0, reallocate data
-    struct mem_block* head = get_header_from_data(ptr);
-    struct mem_block* next = head->next;
-
-    // Case: can expand block into head->next - do so and return header
-    if (try_to_expand_block_into(head, next, size) == 1) {
-        return get_data_from_header(head);
-    }
-    // Case: can't expand - copy over data from old block to new location, free old block, return new location
-    else {
-        void* new_data = malloc(size);
-        struct mem_block* new_head = get_header_from_data(new_data);
-
-        memcpy(new_head, head, head->size);
-        free(ptr);
-
-        return new_data;
-    }
-}
-
-/**
- * @brief      Prints out memory
- */
-void print_memory(void)
-{
-
-    puts("-- Current Memory State --");
-    struct mem_block *current_block = g_head;
-
-    unsigned long current_region = 0;
-
-    while (current_block != NULL) {
-        // Case: New region - print out region string
-        if (current_block ->region_id != current_region || current_block == g_head) {
-            printf("[REGION %lu] %p \n", current_block->region_id, current_block);
-            current_region = current_block->region_id;
-        }
-
-        printf("    [BLOCK] %p-%p in region %lu '%s' %zu [%s] -> %p\n",
-                current_block,
-                (struct mem_block *) ( (char *)current_block + current_block->size ), // do (char *) instead of (void *) b/c char * does 1 byte, whereas void * is undefined/platform-specific
-                current_block->region_id,
-                current_block->name != NULL ? current_block->name : "(NULL)",
-                current_block->size,
-                current_block->free ? "FREE" : "USED",
-                current_block->next);   
-
-        current_block = current_block->next;   
-    }
-}
+/**
+ * @file
+ *
+ * Explores memory management at the C runtime level.
+ *
+ * To use (one specific command):
+ * LD_PRELOAD=$(pwd)/allocator.so command
+ * ('command' will run with your allocator)
+ *
+ * To use (all following commands):
+ * export LD_PRELOAD=$(pwd)/allocator.so
+ * (Everything after this point will use your custom allocator -- be careful!)
+ */
+
+#define _GNU_SOURCE /* For RTLD_NEXT */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "allocator.h"
+#include "logger.h"
+
+/* Gap left at the start of each heap region so that the first block's data (and so every block's
+ * data, since block sizes are multiples of BLOCK_ALIGN) lands on a BLOCK_ALIGN boundary */
+#define REGION_BLOCK_OFFSET ((BLOCK_ALIGN - sizeof(struct mem_block) % BLOCK_ALIGN) % BLOCK_ALIGN)
+
+/* With the algorithm fixed at compile time (make POLICY=...), reuse() and the fits are inlined into
+ * malloc(), so an allocation costs no calls until it has to split a block */
+#ifdef FIXED_FIT
+#define FIT_INLINE inline __attribute__((always_inline))
+#else
+#define FIT_INLINE
+#endif
+
+/* Without MAP_FIXED_NOREPLACE (Linux < 4.17 headers) the address is only a hint; grow_heap() checks
+ * where the pages really went */
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0
+#endif
+
+static struct mem_block *g_head = NULL; /*!< Start (head) of our linked list */
+static struct mem_block *g_tail = NULL;
+
+static unsigned long g_regions = 0; /*!< Allocation counter */
+pthread_mutex_t alloc_mutex = PTHREAD_MUTEX_INITIALIZER; /*< Mutex for protecting the linked list */
+
+static int g_allocations = 0;
+
+static size_t g_blocks = 0; /*!< Number of blocks currently in the linked list */
+static unsigned long g_reserved_blocks = 0; /*!< Free blocks currently marked reserved */
+static size_t g_free_bytes = 0; /*!< Bytes in free blocks across every heap region */
+static size_t g_purge_floor = 0; /*!< Unpurged free bytes the last purge pass couldn't give back */
+
+/* Free index: every free heap block in list order, as parallel arrays so fits scan sizes alone */
+static size_t *g_fit_sizes = NULL; /*!< Fit size of each indexed block (0 while it's reserved) */
+static struct mem_block **g_fit_blocks = NULL; /*!< Indexed blocks, in list order */
+static size_t g_fit_count = 0; /*!< Blocks in the free index */
+static size_t g_fit_capacity = 0; /*!< Entries the index arrays have room for */
+static size_t g_fit_hint = 0; /*!< Slot of the block the last fit returned */
+static int g_fit_isa = -1; /*!< enum fit_isa used by the scans, or -1 until it's been picked */
+
+static struct allocator_stats g_stats = { 0 }; /*!< Counters reported by get_allocator_stats() */
+
+/**
+ * Running totals for the adaptive policy's current window in one size class. Reset every time the
+ * window is evaluated.
+ */
+struct fit_window {
+    unsigned long allocations;
+    unsigned long steps;
+};
+
+static struct fit_window g_fit_windows[FIT_CLASSES]; /*!< Adaptive windows, indexed by size class */
+
+/**
+ * Page map: a two-level radix tree from page number to the descriptor of the region that owns the
+ * page. The root lives in .bss; leaves are mapped on first use and never released, so a published
+ * leaf pointer stays valid forever.
+ */
+static struct mem_region **g_pagemap[PAGEMAP_ROOT_SIZE];
+
+static struct mem_region *g_free_regions = NULL; /*!< Recycled region descriptors */
+static struct mem_region *g_first_region = NULL; /*!< First heap region, in list order */
+static struct mem_region *g_last_region = NULL; /*!< Last heap region, in list order */
+
+static void (*g_libc_free)(void *) = NULL; /*!< free() of the next library (i.e. libc) */
+static void *(*g_libc_realloc)(void *, size_t) = NULL; /*!< realloc() of the next library */
+
+/**
+ * One slot of the guard pool: a single data page between two PROT_NONE pages, plus what we need
+ * to explain a fault in it.
+ */
+struct guard_slot {
+    char *ptr;          /*!< Pointer handed out (right-aligned against the next guard page) */
+    size_t size;        /*!< Size requested */
+    bool allocated;     /*!< Whether the slot is live; freed slots stay PROT_NONE */
+    int next_free;      /*!< Next slot in the reuse queue, or -1 */
+    pid_t alloc_tid;
+    pid_t free_tid;
+    int alloc_depth;
+    int free_depth;
+    void *alloc_stack[GUARD_STACK_DEPTH];
+    void *free_stack[GUARD_STACK_DEPTH];
+};
+
+/**
+ * The guard pool used by sampled allocations. Mapped the first time an allocation is sampled.
+ */
+struct guard_pool {
+    char *base;                 /*!< Start of the pool, or NULL until it's mapped */
+    size_t size;                /*!< Size of the pool, including guard pages */
+    size_t page_size;
+    struct guard_slot *slots;   /*!< Slot metadata, in a separate mapping */
+    int free_head;              /*!< Slot freed longest ago (reused first), or -1 */
+    int free_tail;              /*!< Slot freed most recently, or -1 */
+    struct sigaction previous_action; /*!< SIGSEGV handler we replaced */
+    unsigned long allocations;  /*!< Allocations served from the pool */
+    unsigned long frees;        /*!< Guarded allocations freed */
+};
+
+static struct guard_pool g_guard = { .free_head = -1, .free_tail = -1 };
+pthread_mutex_t guard_mutex = PTHREAD_MUTEX_INITIALIZER; /*< Protects g_guard; taken before alloc_mutex */
+
+static long g_sample_rate = -1; /*!< ALLOCATOR_SAMPLE_RATE, or -1 until it's been read */
+
+/** Allocations left until this thread's next sampled one */
+static __thread long t_sample_countdown __attribute__((tls_model("initial-exec"))) = 0;
+
+/** This thread's sampling random state; 0 until its first allocation */
+static __thread unsigned long t_sample_seed __attribute__((tls_model("initial-exec"))) = 0;
+
+/** Code path taken by this thread's last malloc/free/realloc/calloc (enum latency_outcome) */
+static __thread int t_outcome __attribute__((tls_model("initial-exec"))) = OUTCOME_LIST;
+
+/**
+ * One thread's latency histograms. Threads take one when they first need it and give it back when
+ * they exit, so the counts of exited threads are kept (and picked up by the next thread).
+ */
+struct latency_histograms {
+    unsigned long counts[LATENCY_OPS][LATENCY_OUTCOMES][LATENCY_BUCKETS];
+    bool in_use;
+    struct latency_histograms *next;
+};
+
+static bool g_latency_enabled = false; /*!< ALLOCATOR_LATENCY=1 */
+static struct latency_histograms *g_latency_threads = NULL; /*!< Every histogram set ever mapped */
+static pthread_key_t g_latency_key; /*!< Gives a thread's histograms back when it exits */
+
+/**
+ * A batch of cached blocks of one size class (see init_magazines())
+ */
+struct magazine {
+    struct magazine *next; /*!< Next magazine on a depot list */
+    int rounds; /*!< Blocks held, in blocks[0 .. rounds) */
+    struct mem_block *blocks[MAGAZINE_ROUNDS];
+};
+
+/**
+ * Magazines of one size class that no thread has loaded
+ */
+struct magazine_depot {
+    pthread_mutex_t lock; /*!< Held just long enough to push or pop a magazine */
+    struct magazine *full; /*!< Magazines holding blocks */
+    struct magazine *empty; /*!< Magazines holding none */
+    unsigned long full_count; /*!< Magazines on the full list; read without the lock */
+    unsigned long exchanges; /*!< Magazines threads swapped with this depot */
+};
+
+/**
+ * A thread's magazines: for each size class, the one it takes from and frees into, and the one
+ * before it, which is always either full or empty
+ */
+struct magazine_cache {
+    struct magazine *loaded[MAGAZINE_CLASSES];
+    struct magazine *previous[MAGAZINE_CLASSES];
+    unsigned long allocations; /*!< malloc() calls served from these magazines */
+    unsigned long frees; /*!< free() calls whose block was cached here */
+    bool in_use; /*!< Owned by a live thread */
+    struct magazine_cache *next; /*!< Next set in g_magazine_caches */
+};
+
+static bool g_magazines_enabled = false; /*!< ALLOCATOR_MAGAZINES=1 */
+static struct magazine_depot g_depots[MAGAZINE_CLASSES]; /*!< Depots, indexed by size class */
+static struct magazine_cache *g_magazine_caches = NULL; /*!< Every magazine set ever mapped */
+static pthread_key_t g_magazine_key; /*!< Gives a thread's magazines to the depot when it exits */
+
+static bool g_trace_enabled = false; /*!< ALLOCATOR_TRACE is set and the file is open */
+static int g_trace_fd = -1; /*!< File trace records are written to */
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER; /*!< Held while a record is written */
+static struct trace_record *g_trace_buffer = NULL; /*!< Records not written out yet */
+static size_t g_trace_count = 0; /*!< Records in g_trace_buffer */
+static uint64_t g_trace_start = 0; /*!< CLOCK_MONOTONIC time tracing started, in ns */
+
+/** Thread ID of the calling thread, cached for trace records (0 until its first traced call) */
+static __thread pid_t t_trace_tid __attribute__((tls_model("initial-exec"))) = 0;
+
+/** Set while the calling thread holds trace_mutex, so allocations made under it aren't recorded */
+static __thread bool t_tracing __attribute__((tls_model("initial-exec"))) = false;
+
+/** Magazines of the calling thread, or NULL until its first cached call */
+static __thread struct magazine_cache *t_magazines __attribute__((tls_model("initial-exec"))) = NULL;
+
+/** Histograms of the calling thread, or NULL until its first timed call */
+static __thread struct latency_histograms *t_latency __attribute__((tls_model("initial-exec"))) = NULL;
+
+
+
+/* Func protoyptes */
+void ll_log_block(struct mem_block *block);
+void ll_log_list();
+void ll_add(struct mem_block *prev_block, struct mem_block *new_block);
+void ll_delete(struct mem_block *block);
+
+bool blocks_can_merge(struct mem_block *block, struct mem_block *neighbor);
+
+int try_to_expand_block_into(struct mem_block *head, struct mem_block *next, size_t size);
+bool block_is_available(struct mem_block *block);
+void unreserve_block(struct mem_block *block);
+void trim_block(struct mem_block *block, size_t size);
+size_t get_slack_size(size_t real_size);
+void reserve_slack(struct mem_block *block, size_t real_size);
+
+void *get_data_from_header(struct mem_block *header);
+struct mem_block *get_header_from_data(void *data);
+
+int get_size_bucket(size_t size);
+size_t get_aligned_size(size_t total_size);
+
+void scribble_if_requested(struct mem_block *block, size_t real_size);
+
+void guard_fault_handler(int signo, siginfo_t *info, void *context);
+
+struct mem_block *map_new_region(size_t real_size);
+struct mem_block *add_region_block(struct mem_region *region);
+struct mem_block *get_last_block(struct mem_region *region);
+struct mem_block *extend_region(struct mem_region *region, char *start, size_t length);
+struct mem_block *grow_heap(size_t real_size);
+
+
+/**
+ * @brief      Writes an error message straight to stderr. Unlike fprintf(), this never allocates,
+ *              so it is safe to call from inside the allocator.
+ *
+ * @param[in]  fmt   printf-style format string
+ */
+void report_error(const char *fmt, ...)
+{
+    char message[256];
+    va_list args;
+
+    va_start(args, fmt);
+    int len = vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+
+    if (len > 0) {
+        write(STDERR_FILENO, message, (size_t) len < sizeof(message) ? (size_t) len : sizeof(message) - 1);
+    }
+}
+
+/**
+ * @brief      Finds the region that owns the page ptr points into
+ *
+ * @param[in]  ptr   any address
+ *
+ * @return     descriptor of the owning region, or NULL if the allocator doesn't own the page
+ *
+ * @note       Leaves are never unmapped, so this is safe to call without holding alloc_mutex
+ */
+struct mem_region *pagemap_lookup(void *ptr)
+{
+    uintptr_t page = (uintptr_t) ptr >> PAGEMAP_PAGE_SHIFT;
+    uintptr_t root_index = page >> PAGEMAP_LEAF_BITS;
+
+    if (root_index >= PAGEMAP_ROOT_SIZE) {
+        return NULL;
+    }
+
+    struct mem_region **leaf = __atomic_load_n(&g_pagemap[root_index], __ATOMIC_ACQUIRE);
+
+    if (leaf == NULL) {
+        return NULL;
+    }
+
+    return __atomic_load_n(&leaf[page & (PAGEMAP_LEAF_SIZE - 1)], __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief      Points every page in [start, start + size) at region, mapping leaves as needed
+ *
+ * @param      start   page-aligned start address
+ * @param[in]  size    length of the range
+ * @param      region  descriptor to store, or NULL to clear the range
+ *
+ * @return     false if a leaf could not be mapped, else true
+ */
+bool pagemap_set(void *start, size_t size, struct mem_region *region)
+{
+    uintptr_t first = (uintptr_t) start >> PAGEMAP_PAGE_SHIFT;
+    uintptr_t last = ((uintptr_t) start + size - 1) >> PAGEMAP_PAGE_SHIFT;
+
+    for (uintptr_t page = first; page <= last; page++) {
+        uintptr_t root_index = page >> PAGEMAP_LEAF_BITS;
+        struct mem_region **leaf = g_pagemap[root_index];
+
+        if (leaf == NULL) {
+            // Case: clearing - nothing was ever stored under this root entry
+            if (region == NULL) {
+                page |= PAGEMAP_LEAF_SIZE - 1;
+                continue;
+            }
+
+            leaf = mmap(NULL, PAGEMAP_LEAF_SIZE * sizeof(struct mem_region *), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+            if (leaf == MAP_FAILED) {
+                return false;
+            }
+
+            __atomic_store_n(&g_pagemap[root_index], leaf, __ATOMIC_RELEASE);
+        }
+
+        __atomic_store_n(&leaf[page & (PAGEMAP_LEAF_SIZE - 1)], region, __ATOMIC_RELEASE);
+    }
+
+    return true;
+}
+
+/**
+ * @brief      Takes a descriptor from the recycled pool, refilling the pool a page at a time
+ *
+ * @return     an unused descriptor, or NULL if no memory is available
+ */
+struct mem_region *acquire_region(void)
+{
+    if (g_free_regions == NULL) {
+        size_t page_size = getpagesize();
+        struct mem_region *batch = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (batch == MAP_FAILED) {
+            return NULL;
+        }
+
+        for (size_t i = 0; i < page_size / sizeof(struct mem_region); i++) {
+            release_region(&batch[i]);
+        }
+    }
+
+    struct mem_region *region = g_free_regions;
+    g_free_regions = region->next;
+
+    return region;
+}
+
+/**
+ * @brief      Returns a descriptor to the recycled pool. The region must already be unregistered.
+ *
+ * @param      region  descriptor
+ */
+void release_region(struct mem_region *region)
+{
+    region->next = g_free_regions;
+    g_free_regions = region;
+}
+
+/**
+ * @brief      Creates a descriptor for a freshly mapped range and records it in the page map
+ *
+ * @param      base  start of the mapping
+ * @param[in]  size  size of the mapping
+ * @param[in]  kind  what the region holds (enum region_kind)
+ *
+ * @return     the new descriptor, or NULL if it (or the page map) could not be allocated
+ */
+struct mem_region *register_region(void *base, size_t size, int kind)
+{
+    struct mem_region *region = acquire_region();
+
+    if (region == NULL) {
+        return NULL;
+    }
+
+    region->base = base;
+    region->size = size;
+    region->kind = kind;
+    region->retained = false;
+    region->next = NULL;
+
+    if (!pagemap_set(base, size, region)) {
+        pagemap_set(base, size, NULL);
+        release_region(region);
+        return NULL;
+    }
+
+    region->id = g_regions++;
+    return region;
+}
+
+/**
+ * @brief      Removes a region from the page map. Its pages are no longer considered ours.
+ *
+ * @param      region  region
+ */
+void unregister_region(struct mem_region *region)
+{
+    pagemap_set(region->base, region->size, NULL);
+}
+
+/**
+ * @brief      Registers a mapping made outside the allocator, so its pointers are recognized as
+ *              ours. Takes alloc_mutex.
+ *
+ * @param      base  start of the mapping
+ * @param[in]  size  size of the mapping
+ * @param[in]  kind  what it holds (enum region_kind)
+ *
+ * @return     the region, or NULL if the page map couldn't be extended
+ */
+struct mem_region *adopt_mapping(void *base, size_t size, int kind)
+{
+    pthread_mutex_lock(&alloc_mutex);
+    struct mem_region *region = register_region(base, size, kind);
+    pthread_mutex_unlock(&alloc_mutex);
+
+    return region;
+}
+
+/**
+ * @brief      Forgets a mapping registered by adopt_mapping(). The caller unmaps it afterwards.
+ *
+ * @param      region  region (may be NULL)
+ */
+void drop_mapping(struct mem_region *region)
+{
+    if (region == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&alloc_mutex);
+    unregister_region(region);
+    release_region(region);
+    pthread_mutex_unlock(&alloc_mutex);
+}
+
+/**
+ * @brief      Tells whether block is the header of a live allocation in region: it must lie inside
+ *              the region, carry BLOCK_MAGIC and be in use.
+ *
+ * @param      region  region that owns the page the user's pointer is in
+ * @param      block   header computed from the user's pointer
+ *
+ * @return     true if block is a live allocation's header
+ */
+bool block_is_valid(struct mem_region *region, struct mem_block *block)
+{
+    return region->kind == REGION_HEAP
+        && (char *) block >= (char *) region->base
+        && block->magic == BLOCK_MAGIC
+        && !block->free;
+}
+
+/**
+ * @brief      Gets the first block of a heap region. Merges always keep the lower header, so this
+ *              block exists for as long as the region does.
+ *
+ * @param      region  heap region
+ *
+ * @return     first block in the region
+ */
+struct mem_block *get_first_block(struct mem_region *region)
+{
+    return (struct mem_block *) ((char *) region->base + REGION_BLOCK_OFFSET);
+}
+
+/**
+ * @brief      Accounts for an allocation taking (part of) a free block
+ *
+ * @param      region  region the block is in
+ * @param[in]  used    bytes of it that are now in use
+ */
+void region_used_run(struct mem_region *region, size_t used)
+{
+    region->free_bytes -= used;
+    g_free_bytes -= used;
+}
+
+/**
+ * @brief      Accounts for bytes going back to a region's free space
+ *
+ * @param      region  region the bytes are in
+ * @param[in]  freed   bytes that became free
+ */
+void region_freed_run(struct mem_region *region, size_t freed)
+{
+    region->free_bytes += freed;
+    g_free_bytes += freed;
+}
+
+/**
+ * @brief      Frees memory that was allocated by libc rather than by us (e.g. by its own
+ *              memalign(), or before we were loaded)
+ *
+ * @param      ptr   pointer from libc
+ */
+void libc_free(void *ptr)
+{
+    if (g_libc_free == NULL) {
+        g_libc_free = (void (*)(void *)) dlsym(RTLD_NEXT, "free");
+    }
+
+    if (g_libc_free != NULL) {
+        g_libc_free(ptr);
+    }
+}
+
+/**
+ * @brief      Resizes memory that was allocated by libc rather than by us
+ *
+ * @param      ptr   pointer from libc
+ * @param[in]  size  requested size
+ *
+ * @return     libc's result, or NULL if libc's realloc() can't be found
+ */
+void *libc_realloc(void *ptr, size_t size)
+{
+    if (g_libc_realloc == NULL) {
+        g_libc_realloc = (void *(*)(void *, size_t)) dlsym(RTLD_NEXT, "realloc");
+    }
+
+    return g_libc_realloc != NULL ? g_libc_realloc(ptr, size) : NULL;
+}
+
+/**
+ * @brief      Gets a thread's next sampling interval: uniformly distributed in [1, 2 * rate] so
+ *              that allocation patterns with a fixed period can't always dodge the sampler
+ *
+ * @return     number of allocations until the next sampled one
+ */
+long next_sample_interval(void)
+{
+    // xorshift64
+    t_sample_seed ^= t_sample_seed << 13;
+    t_sample_seed ^= t_sample_seed >> 7;
+    t_sample_seed ^= t_sample_seed << 17;
+
+    return 1 + (long) (t_sample_seed % (2 * (unsigned long) g_sample_rate));
+}
+
+/**
+ * @brief      Reads ALLOCATOR_SAMPLE_RATE. Until this has run, no allocation is sampled.
+ */
+void init_sampling(void)
+{
+    char *setting = getenv("ALLOCATOR_SAMPLE_RATE");
+    long rate = setting != NULL ? strtol(setting, NULL, 10) : 0;
+
+    if (rate > 0) {
+        // backtrace() loads libgcc_s the first time it's called. Get that over with now rather than
+        // inside an allocation made while the dynamic linker is busy (e.g. during dlopen()).
+        void *frame;
+        backtrace(&frame, 1);
+    }
+
+    __atomic_store_n(&g_sample_rate, rate > 0 ? rate : 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief      Slow path of malloc()'s sampling countdown, taken when a thread's countdown runs
+ *              out. Reloads the countdown and, if guarded sampling is on, serves the request from
+ *              the guard pool.
+ *
+ * @param[in]  size  requested size
+ *
+ * @return     guarded allocation, or NULL if this request should go through the regular heap
+ */
+void *sample_allocation(size_t size)
+{
+    long rate = __atomic_load_n(&g_sample_rate, __ATOMIC_RELAXED);
+
+    // Case: allocator_init() hasn't run yet - check again on the next allocation
+    if (rate < 0) {
+        t_sample_countdown = 1;
+        return NULL;
+    }
+
+    // Case: sampling is off - push the countdown out of reach so we never come back here
+    if (rate == 0) {
+        t_sample_countdown = LONG_MAX;
+        return NULL;
+    }
+
+    // Case: thread's first allocation - seed its generator but don't sample yet
+    if (t_sample_seed == 0) {
+        t_sample_seed = ((uintptr_t) &t_sample_seed ^ (uintptr_t) time(NULL)) | 1;
+        t_sample_countdown = next_sample_interval();
+        return NULL;
+    }
+
+    t_sample_countdown = next_sample_interval();
+
+    if (size == 0 || size > (size_t) getpagesize()) {
+        return NULL;
+    }
+
+    return guarded_malloc(size);
+}
+
+/**
+ * @brief      Maps the guard pool: GUARD_SLOTS data pages, each surrounded by PROT_NONE pages, plus
+ *              the slot metadata. The pool is registered in the page map as a REGION_GUARD
+ *              region so free() can recognize its pointers without a header. Called with
+ *              guard_mutex held.
+ *
+ * @return     true if the pool is ready
+ */
+bool init_guard_pool(void)
+{
+    if (g_guard.base != NULL) {
+        return true;
+    }
+
+    size_t page_size = getpagesize();
+    size_t pool_size = (2 * GUARD_SLOTS + 1) * page_size;
+    size_t slots_size = get_region_size(GUARD_SLOTS * sizeof(struct guard_slot));
+
+    char *base = mmap(NULL, pool_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+
+    struct guard_slot *slots = mmap(NULL, slots_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slots == MAP_FAILED) {
+        munmap(base, pool_size);
+        return false;
+    }
+
+    pthread_mutex_lock(&alloc_mutex);
+    struct mem_region *region = register_region(base, pool_size, REGION_GUARD);
+    pthread_mutex_unlock(&alloc_mutex);
+
+    if (region == NULL) {
+        munmap(slots, slots_size);
+        munmap(base, pool_size);
+        return false;
+    }
+
+    // Every slot starts out free, queued in address order
+    for (int i = 0; i < GUARD_SLOTS; i++) {
+        slots[i].next_free = i + 1 < GUARD_SLOTS ? i + 1 : -1;
+    }
+    g_guard.free_head = 0;
+    g_guard.free_tail = GUARD_SLOTS - 1;
+
+    g_guard.slots = slots;
+    g_guard.page_size = page_size;
+    g_guard.size = pool_size;
+
+    struct sigaction action = { 0 };
+    action.sa_sigaction = guard_fault_handler;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &g_guard.previous_action);
+
+    // Publish last: guard_fault_handler() and free() only look at the pool once base is set
+    __atomic_store_n(&g_guard.base, base, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief      Gets the data page of a guard slot
+ *
+ * @param[in]  slot  slot index
+ *
+ * @return     start of the slot's data page
+ */
+char *get_guard_slot_page(int slot)
+{
+    return g_guard.base + (2 * slot + 1) * g_guard.page_size;
+}
+
+/**
+ * @brief      Serves an allocation from the guard pool. The data is pushed against the end of a
+ *              data page so that running off the end touches the PROT_NONE page after it. Slots are
+ *              recycled in the order they were freed, so freed memory stays inaccessible for as
+ *              long as possible.
+ *
+ * @param[in]  size  requested size (at most one page)
+ *
+ * @return     guarded allocation, or NULL if the pool is unavailable
+ */
+void *guarded_malloc(size_t size)
+{
+    void *stack[GUARD_STACK_DEPTH];
+    int depth = backtrace(stack, GUARD_STACK_DEPTH); // may allocate the first time; no locks held yet
+
+    pthread_mutex_lock(&guard_mutex);
+
+    if (!init_guard_pool() || g_guard.free_head == -1) {
+        pthread_mutex_unlock(&guard_mutex);
+        return NULL;
+    }
+
+    int index = g_guard.free_head;
+    struct guard_slot *slot = &g_guard.slots[index];
+
+    g_guard.free_head = slot->next_free;
+    if (g_guard.free_head == -1) {
+        g_guard.free_tail = -1;
+    }
+
+    char *page = get_guard_slot_page(index);
+
+    if (mprotect(page, g_guard.page_size, PROT_READ | PROT_WRITE) == -1) {
+        // Put the slot back where it was and let the regular heap handle this one
+        slot->next_free = g_guard.free_head;
+        g_guard.free_head = index;
+        if (g_guard.free_tail == -1) {
+            g_guard.free_tail = index;
+        }
+        pthread_mutex_unlock(&guard_mutex);
+        return NULL;
+    }
+
+    size_t aligned_size = (size + GUARD_ALIGN - 1) & ~((size_t) GUARD_ALIGN - 1);
+    char *ptr = page + g_guard.page_size - (aligned_size < g_guard.page_size ? aligned_size : g_guard.page_size);
+
+    slot->ptr = ptr;
+    slot->size = size;
+    slot->allocated = true;
+    slot->alloc_tid = gettid();
+    slot->alloc_depth = depth;
+    memcpy(slot->alloc_stack, stack, depth * sizeof(void *));
+    slot->free_depth = 0;
+
+    g_guard.allocations++;
+    pthread_mutex_unlock(&guard_mutex);
+
+    return ptr;
+}
+
+/**
+ * @brief      Finds the slot a guarded pointer belongs to
+ *
+ * @param[in]  ptr   pointer into the guard pool
+ *
+ * @return     slot index, or -1 if ptr is on a guard page
+ */
+int get_guard_slot(const void *ptr)
+{
+    size_t page = ((const char *) ptr - g_guard.base) / g_guard.page_size;
+
+    return page % 2 == 1 ? (int) (page / 2) : -1;
+}
+
+/**
+ * @brief      Gets the usable size of a guarded allocation
+ *
+ * @param[in]  ptr   guarded allocation
+ *
+ * @return     size originally requested, or 0 if ptr is not a live guarded allocation
+ */
+size_t guarded_size(void *ptr)
+{
+    pthread_mutex_lock(&guard_mutex);
+
+    int index = get_guard_slot(ptr);
+    size_t size = 0;
+
+    if (index != -1 && g_guard.slots[index].allocated && g_guard.slots[index].ptr == ptr) {
+        size = g_guard.slots[index].size;
+    }
+
+    pthread_mutex_unlock(&guard_mutex);
+    return size;
+}
+
+/**
+ * @brief      Frees a guarded allocation: the page is made inaccessible again (so later accesses
+ *              fault as use-after-free) and the slot goes to the back of the reuse queue
+ *
+ * @param      ptr   pointer returned by guarded_malloc()
+ */
+void guarded_free(void *ptr)
+{
+    void *stack[GUARD_STACK_DEPTH];
+    int depth = backtrace(stack, GUARD_STACK_DEPTH);
+
+    pthread_mutex_lock(&guard_mutex);
+
+    int index = get_guard_slot(ptr);
+    struct guard_slot *slot = index != -1 ? &g_guard.slots[index] : NULL;
+
+    if (slot == NULL || !slot->allocated || slot->ptr != ptr) {
+        pthread_mutex_unlock(&guard_mutex);
+        report_error("free(): invalid pointer %p (guarded allocation%s)\n", ptr,
+                slot != NULL && !slot->allocated && slot->ptr == ptr ? " freed twice" : "");
+        return;
+    }
+
+    mprotect(get_guard_slot_page(index), g_guard.page_size, PROT_NONE);
+
+    slot->allocated = false;
+    slot->free_tid = gettid();
+    slot->free_depth = depth;
+    memcpy(slot->free_stack, stack, depth * sizeof(void *));
+
+    slot->next_free = -1;
+    if (g_guard.free_tail == -1) {
+        g_guard.free_head = index;
+    }
+    else {
+        g_guard.slots[g_guard.free_tail].next_free = index;
+    }
+    g_guard.free_tail = index;
+
+    g_guard.frees++;
+    pthread_mutex_unlock(&guard_mutex);
+}
+
+/**
+ * @brief      Adds the guard pool's counters to a copy of g_stats. They're kept in g_guard, under
+ *              guard_mutex, rather than in g_stats, which alloc_mutex protects.
+ *
+ * @param      stats  copy of g_stats
+ */
+void add_guard_stats(struct allocator_stats *stats)
+{
+    pthread_mutex_lock(&guard_mutex);
+    stats->guarded_allocations = g_guard.allocations;
+    stats->guarded_frees = g_guard.frees;
+    pthread_mutex_unlock(&guard_mutex);
+}
+
+/**
+ * @brief      Prints one side (allocation or free) of a guarded slot's history
+ *
+ * @param[in]  what   "allocated" or "freed"
+ * @param[in]  tid    thread that did it
+ * @param      stack  return addresses captured at the time
+ * @param[in]  depth  number of return addresses
+ */
+void report_guard_stack(const char *what, pid_t tid, void **stack, int depth)
+{
+    report_error("%s by thread %d:\n", what, (int) tid);
+    backtrace_symbols_fd(stack, depth, STDERR_FILENO);
+}
+
+/**
+ * @brief      SIGSEGV handler. Faults inside the guard pool are reported as heap-buffer-overflow
+ *              (a guard page was touched) or use-after-free (a freed slot was touched), together
+ *              with the allocation and free stacks; the default action is then restored so the
+ *              faulting access crashes the process as usual. Other faults go to whatever handler
+ *              was installed before us.
+ *
+ * @param[in]  signo    signal number
+ * @param      info     fault information
+ * @param      context  user context
+ */
+void guard_fault_handler(int signo, siginfo_t *info, void *context)
+{
+    char *base = __atomic_load_n(&g_guard.base, __ATOMIC_ACQUIRE);
+    char *addr = info->si_addr;
+
+    if (base == NULL || addr < base || addr >= base + g_guard.size) {
+        if (g_guard.previous_action.sa_flags & SA_SIGINFO) {
+            g_guard.previous_action.sa_sigaction(signo, info, context);
+            return;
+        }
+        if (g_guard.previous_action.sa_handler != SIG_DFL && g_guard.previous_action.sa_handler != SIG_IGN) {
+            g_guard.previous_action.sa_handler(signo);
+            return;
+        }
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+
+    int index = get_guard_slot(addr);
+    const char *kind = "use-after-free";
+
+    // Case: guard page - blame the slot whose allocation it borders (the left one when both could be)
+    if (index == -1) {
+        int page = (addr - base) / g_guard.page_size;
+        int left = page / 2 - 1;
+        int right = page / 2;
+
+        kind = "heap-buffer-overflow";
+        index = left >= 0 && g_guard.slots[left].ptr != NULL ? left : right;
+
+        if (index >= GUARD_SLOTS || g_guard.slots[index].ptr == NULL) {
+            index = -1;
+        }
+    }
+
+    report_error("==%d== guarded allocation error: %s at %p\n", (int) getpid(), kind, (void *) addr);
+
+    if (index != -1) {
+        struct guard_slot *slot = &g_guard.slots[index];
+        char *ptr = slot->ptr;
+
+        if (addr >= ptr + slot->size) {
+            report_error("%zu bytes after the %zu-byte %s allocation at %p\n",
+                    (size_t) (addr - (ptr + slot->size)), slot->size, slot->allocated ? "live" : "freed", ptr);
+        }
+        else if (addr < ptr) {
+            report_error("%zu bytes before the %zu-byte %s allocation at %p\n",
+                    (size_t) (ptr - addr), slot->size, slot->allocated ? "live" : "freed", ptr);
+        }
+        else {
+            report_error("%zu bytes into the %zu-byte %s allocation at %p\n",
+                    (size_t) (addr - ptr), slot->size, slot->allocated ? "live" : "freed", ptr);
+        }
+
+        report_guard_stack("allocated", slot->alloc_tid, slot->alloc_stack, slot->alloc_depth);
+
+        if (!slot->allocated) {
+            report_guard_stack("freed", slot->free_tid, slot->free_stack, slot->free_depth);
+        }
+    }
+
+    // Returning re-runs the faulting access, which now takes the default action
+    signal(SIGSEGV, SIG_DFL);
+}
+
+/**
+ * @brief      Runs once when the library is loaded, before main(). Allocations can (and do) happen
+ *              before this, so everything set up here must have a sensible not-yet-initialized
+ *              state.
+ */
+__attribute__((constructor))
+void allocator_init(void)
+{
+    init_sampling();
+    init_mem_limit();
+    init_reserve();
+    init_magazines();
+    init_latency();
+    init_trace();
+}
+
+/**
+ * @brief      Runs when the library is unloaded or the process exits normally. Writes out the
+ *              trace records still buffered; later calls aren't recorded.
+ */
+__attribute__((destructor))
+void allocator_fini(void)
+{
+    if (!g_trace_enabled) {
+        return;
+    }
+
+    pthread_mutex_lock(&trace_mutex);
+    flush_trace();
+    g_trace_enabled = false;
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+/**
+ * @brief      If able, expands a used block into next block. Else, does nothing
+ *
+ * @param      head  used block
+ * @param      next  block right after head
+ * @param      size  requested size (includes header)
+ * 
+ * @return     0 if can't merge, 1 if it can and did
+ *
+ * @note       blocks_can_merge() only joins free blocks, so head (which is in use) is checked here
+ */
+int try_to_expand_block_into(struct mem_block *head, struct mem_block *next, size_t size)
+{
+    if (next == NULL || head->next != next || !next->free || next->region_id != head->region_id
+            || head->size + next->size < size) {
+        return 0;
+    }
+
+    unreserve_block(next);
+    unpurge_block(next);
+    region_used_run(pagemap_lookup(head), next->size);
+    head->size += next->size;
+    ll_delete(next);
+    return 1;
+}
+
+/**
+ * @brief      Tells whether a fit may hand out block: it has to be free, and not slack reserved for
+ *              a growing allocation (see claim_reserved_fit())
+ *
+ * @param      block  block
+ *
+ * @return     true if block can be allocated
+ */
+bool block_is_available(struct mem_block *block)
+{
+    return block->free && !block->reserved;
+}
+
+/**
+ * @brief      Turns reserved slack back into an ordinary free block
+ *
+ * @param      block  block (does nothing if it isn't reserved)
+ */
+void unreserve_block(struct mem_block *block)
+{
+    if (block->reserved) {
+        block->reserved = false;
+        g_reserved_blocks--;
+        free_index_update(block);
+    }
+}
+
+/**
+ * @brief      Cuts a used block down to size, giving the end back to the free list if it's big
+ *              enough to stand as a block of its own
+ *
+ * @param      block  used block
+ * @param[in]  size   size to keep (includes header)
+ */
+void trim_block(struct mem_block *block, size_t size)
+{
+    block->free = true;
+    struct mem_block *tail = split_block(block, size);
+    block->free = false;
+
+    if (tail != NULL) {
+        size_t freed = tail->size;
+
+        tail = merge_block(tail);
+        region_freed_run(pagemap_lookup(block), freed);
+        purge_if_pressured(tail);
+    }
+}
+
+/**
+ * @brief      Gets how much slack to keep after a growing allocation: as much again as it now
+ *              holds, so capacity grows geometrically, up to REALLOC_SLACK_MAX
+ *
+ * @param[in]  real_size  size of the allocation (includes header)
+ *
+ * @return     slack size in bytes
+ */
+size_t get_slack_size(size_t real_size)
+{
+    return get_aligned_size(real_size < REALLOC_SLACK_MAX ? real_size : REALLOC_SLACK_MAX);
+}
+
+/**
+ * @brief      Sizes a block that realloc() just grew. Once the allocation has been realloc'd
+ *              REALLOC_SLACK_AFTER times it's probably a buffer that keeps growing, so the space
+ *              after it (up to get_slack_size()) is split off as a reserved free block: fits pass
+ *              over it, and the next realloc() can expand into it without copying. reuse() takes
+ *              it back if nothing else fits. Anything past the slack is trimmed as usual.
+ *
+ * @param      block      used block, already at least real_size
+ * @param[in]  real_size  size the allocation needs (includes header)
+ */
+void reserve_slack(struct mem_block *block, size_t real_size)
+{
+    if (block->reallocs < REALLOC_SLACK_AFTER) {
+        trim_block(block, real_size);
+        return;
+    }
+
+    trim_block(block, real_size + get_slack_size(real_size));
+
+    block->free = true;
+    struct mem_block *slack = split_block(block, real_size);
+    block->free = false;
+
+    if (slack != NULL) {
+        slack->reserved = true;
+        g_reserved_blocks++;
+        g_stats.slack_reservations++;
+        region_freed_run(pagemap_lookup(block), slack->size);
+        free_index_add(slack);
+    }
+}
+
+/**
+ * @brief      Given a header, returns the data block associated with it
+ *
+ * @param      header  header
+ *
+ * @return     data block associated with header
+ */
+void *get_data_from_header(struct mem_block *header)
+{
+    return header != NULL ? header + 1 : NULL;
+}
+
+/**
+ * @brief      Given a block of data, returns the header associated with it
+ *
+ * @param      data  data block
+ *
+ * @return     header associated with data block
+ */
+struct mem_block *get_header_from_data(void *data)
+{
+    // Through uintptr_t: data often comes straight from malloc(), which <stdlib.h> declares as
+    // returning a fresh object, so the compiler would take anything before it to be out of bounds
+    return data != NULL ? (struct mem_block *) ((uintptr_t) data - sizeof(struct mem_block)) : NULL;
+}
+
+/**
+ * @brief      Gets total_size, aligned to be divisble by BLOCK_ALIGN, to work with certain architectures
+ *
+ * @param[in]  total_size  total size
+ *
+ * @return     total_size, increased until it is divisible by BLOCK_ALIGN
+ */
+size_t get_aligned_size(size_t total_size)
+{
+    return total_size % BLOCK_ALIGN == 0 ? total_size :
+        total_size + (BLOCK_ALIGN - (total_size % BLOCK_ALIGN));
+}
+
+/**
+ * @brief      Gets size of a new region
+ *
+ * @param[in]  real_size  size of data block + size of header
+ *
+ * @return     real_size, increased until it is divisible by getpagesize() (as of time
+ *              of this writing, 4096)
+ */
+size_t get_region_size(size_t real_size)
+{
+    int page_size = getpagesize();
+
+    size_t num_pages = real_size % page_size != 0 ? real_size / page_size + 1 :
+        real_size / page_size;
+
+    return page_size * num_pages;
+}
+
+/**
+ * @brief      Adds a block to a block that already exists in a linked list
+ *
+ * @param      prev_block  block we add new block to
+ * @param      new_block   block we add to linked list
+ */
+void ll_add(struct mem_block *prev_block, struct mem_block *new_block)
+{
+
+
+    sprintf(new_block->name, "New block %d", g_allocations + 1);
+    ll_log_block(prev_block);
+    ll_log_block(new_block);
+
+    LOGP("BOOKMARK\n");
+    struct mem_block *next_block;
+
+    if (new_block == NULL || prev_block == NULL || new_block == prev_block->next) {
+        LOGP("RETURNING\n");
+        return;
+    }
+
+    if (prev_block != NULL && new_block != NULL) {
+        next_block = prev_block->next;
+        prev_block->next = new_block;
+        new_block->prev = prev_block;
+
+    }
+
+    if (new_block != NULL && next_block != NULL) {
+        next_block->prev = new_block;
+        new_block->next = next_block;
+    }
+
+    g_blocks++;
+
+    LOGP("DONE\n");
+    ll_log_block(prev_block);
+
+
+
+
+
+}
+
+/**
+ * @brief      Deletes a block from the linked list, updating g_head and g_tail as needed
+ *
+ * @param      block  block we will delete
+ */
+void ll_delete(struct mem_block *block) {
+
+    if (block == NULL) {
+        return;
+    }
+
+    struct mem_block* prev = block->prev;
+    struct mem_block* next = block->next;
+
+    free_index_remove(block);
+
+    // Case: prev exists - link prev w/ next
+    if (prev != NULL) {
+        prev->next = next;    
+    }
+    // Case: next exists - link next w/ prev
+    if (next != NULL) {
+        next->prev = prev;    
+    }
+    // Case: block was g_tail - make g_tail = prev
+    if (block == g_tail) {
+        g_tail = prev;
+    }
+
+    // Case: block was g_head - make g_head = next
+    if (block == g_head) {
+        g_head = next;
+    }
+
+    // Block is gone from the list, so its header no longer marks the start of a block
+    block->magic = 0;
+    g_blocks--;
+}
+
+/**
+ * @brief      Logs info from a given block
+ *
+ * @param      block  memory block
+ * 
+ * @note       Warning: Useful but segfaults often - if there are segfaults in code, might want
+ *              to comment out calls to this func first
+ */
+void ll_log_block(struct mem_block *block) {
+
+    if (block == NULL) {
+        LOGP("NULL BLOCK\n");
+        return;
+    }
+    LOG(" %p <----- %p -----> %p\n", block->prev, block, block->next);
+
+    LOG(" '%s' <----- '%s' -----> '%s'\n",
+        block->prev != NULL ? block->prev->name : "NULL BLOCK",
+        block->name,
+        block->next != NULL ? block->next->name: "NULL BLOCK");
+
+    if (block->next != NULL && strcmp(block->next->name, "Test Allocation: 4") == 0) {
+        LOGP("4TH ALLOCATION DETECTED\n");
+        LOG("\t----->'%s'\n", block->next->next->name);
+    }
+    LOGP("\n");
+}
+
+/**
+ * @brief      Logs info from the whole linked list
+ * 
+ * @note       Not using ll_log_block to avoid segfaults
+ */
+void ll_log_list() {
+
+    LOG("STARITNG FROM HEAD: %p '%s'------------------------------------------------------------------------------------------------->\n", g_head, g_head != NULL ? g_head->name : "NULL BLOCK");
+    struct mem_block *current = g_head;
+
+    while (current != NULL) {
+        LOG("%p -----> %p\n", current, current->next);
+        LOG("'%s' -----> '%s'\n\n", current->name, current->next != NULL ? current->next->name : "NULL BLOCK");
+       current = current->next;
+    }
+}
+
+
+
+
+/**
+ * @brief      Given a free block, this function will split it into two pieces and update
+ *              the linked list.
+ *
+ * @param      block  the block to split
+ * @param[in]  size   new size of the first block after the split is complete,
+ *                      including header sizes. The size of the second block will be the original
+ *                      block's size minus this parameter.
+ *
+ * @return     address of the resulting second block (the original address will be
+ *              unchanged) or NULL if the block cannot be split.
+ *              
+ * @note       This description is from Prof. Matthew. The only change is that it's been reformatted.
+ *              Also, size includes header size
+ */
+struct mem_block *split_block(struct mem_block *block, size_t size)
+{
+    size_t min_sz = sizeof(struct mem_block) + BLOCK_ALIGN;
+
+    // The first piece only has to hold its header (malloc(1) asks for 104 bytes); the leftover has
+    // to be big enough to be worth keeping as a free block
+    if (size < sizeof(struct mem_block) || block == NULL || !block->free) {
+        LOGP("INVALID - RETURNING NULL\n");
+        return NULL;
+    }
+    if (size > block->size || block->size - size < min_sz) {
+        LOG("NEW BLOCK WOULD BE SIZE: %zu - too small returning null\n", block->size - size);
+        return NULL;
+    }
+
+    struct mem_block* leftover_data_header = (struct mem_block *) ( (char *)block + size  );
+
+    leftover_data_header->magic = BLOCK_MAGIC;
+    leftover_data_header->free = true;
+    leftover_data_header->reserved = false;
+    leftover_data_header->purged = false;
+    leftover_data_header->reallocs = 0;
+    leftover_data_header->prev = NULL;
+    leftover_data_header->next = NULL;
+    leftover_data_header->region_id = block->region_id;
+    leftover_data_header->size = block->size - size;
+
+    /* REGION: Change size of block */
+    block->size = size;
+
+    /* REGION: Update linked list and tail */
+    ll_add(block, leftover_data_header);
+
+    if (block == g_tail) {
+        g_tail = leftover_data_header;
+        g_tail->next = NULL;
+    }
+
+    return leftover_data_header;
+}
+
+/**
+ * Given a free block, this function attempts to merge it with neighboring
+ * blocks --- both the previous and next neighbors --- and update the linked
+ * list accordingly.
+ *
+ * @param block the block to merge
+ *
+ * @return address of the merged block or NULL if the block cannot be merged.
+ */
+
+/**
+ * @brief       Given a free block, this function attempts to merge it with neighboring
+                blocks --- both the previous and next neighbors --- and update the linked
+                list accordingly.
+ *
+ * @param      block  the block to merge
+ *
+ * @return     address of the merged block or NULL if the block cannot be merged.
+ *
+ * @note       Again Prof. Matthew's words, reformatted
+ */
+struct mem_block *merge_block(struct mem_block *block)
+{
+    struct mem_block* header = block;
+
+    // Reserved slack is kept apart from the free block after it, so there can be more than one
+    // free neighbor on each side
+    while (blocks_can_merge(header, header->next)) {
+        unpurge_block(header);
+        unpurge_block(header->next);
+        unreserve_block(header->next);
+        header->size += header->next->size;
+        ll_delete(header->next);
+    }
+
+    while (blocks_can_merge(header, header->prev)) {
+        struct mem_block *prev = header->prev;
+
+        unpurge_block(header);
+        unpurge_block(prev);
+        prev->size += header->size;
+        ll_delete(header);
+        header = prev;
+    }
+
+    // Slack that gained a neighbor isn't tied to the allocation before it anymore
+    unreserve_block(header);
+    free_index_add(header);
+
+    return header;
+}
+
+/* Returns true if the following are true:
+    1. neighbor exists
+    2. neighbor and block have same region ids
+    3. block and neighbor are both free (will instantly return false if block is not free)
+
+    Else, returns false
+    */
+
+/**
+ * @brief      Returns true if the following are true:
+ *              1. neighbor exists
+ *              2. neighbor and block have same region ids
+ *              3. neighbor and block are both free 
+ *
+ * @param      block     block
+ * @param      neighbor  neighboring block (will check in function to make sure this is the case)
+ *
+ * @return     true if the above conditions are all true, else false
+ */
+bool blocks_can_merge(struct mem_block *block, struct mem_block *neighbor) {
+
+    if (!block->free) {
+       LOG("ERROR - BLOCK IS USED: '%s' - returning immediately\n", !block->free ? "USED" : "FREE");
+       return false;
+    }
+
+    if (block->next != neighbor && block->prev != neighbor) {
+        LOGP("ERROR - NOT NEIGHBORS - RETURNING FALSE\n");
+        return false;
+    }
+
+    return neighbor != NULL && block->region_id == neighbor->region_id && neighbor->free;
+}
+
+
+/**
+ * @brief      Tells whether block comes before other in the list. Heap regions are appended to the
+ *              list as they're registered, so list order is region id order, and address order
+ *              within a region.
+ *
+ * @param      block  block
+ * @param      other  another block
+ *
+ * @return     true if block comes first
+ */
+bool block_precedes(struct mem_block *block, struct mem_block *other)
+{
+    if (block->region_id != other->region_id) {
+        return block->region_id < other->region_id;
+    }
+
+    return block < other;
+}
+
+/**
+ * @brief      Finds block's slot in the free index by binary search, trying the block the last fit
+ *              returned first
+ *
+ * @param      block  block
+ * @param      found  set to whether block is in the index
+ *
+ * @return     block's slot, or the slot it would be inserted at
+ */
+size_t free_index_find(struct mem_block *block, bool *found)
+{
+    if (g_fit_hint < g_fit_count && g_fit_blocks[g_fit_hint] == block) {
+        *found = true;
+        return g_fit_hint;
+    }
+
+    size_t low = 0;
+    size_t high = g_fit_count;
+
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+
+        if (block_precedes(g_fit_blocks[middle], block)) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    *found = low < g_fit_count && g_fit_blocks[low] == block;
+    return low;
+}
+
+/**
+ * @brief      Makes room for one more entry in the free index, doubling both arrays with mremap()
+ *              when they're full
+ *
+ * @return     false if the arrays couldn't grow
+ */
+bool free_index_grow(void)
+{
+    if (g_fit_count < g_fit_capacity) {
+        return true;
+    }
+
+    size_t capacity = g_fit_capacity == 0 ? getpagesize() / sizeof(size_t) : g_fit_capacity * 2;
+    size_t old_length = g_fit_capacity * sizeof(size_t);
+    size_t length = capacity * sizeof(size_t);
+    const int prot_flags = PROT_READ | PROT_WRITE;
+    const int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    size_t *sizes = g_fit_capacity == 0 ? mmap(NULL, length, prot_flags, map_flags, -1, 0)
+        : mremap(g_fit_sizes, old_length, length, MREMAP_MAYMOVE);
+
+    if (sizes == MAP_FAILED) {
+        return false;
+    }
+
+    struct mem_block **blocks = g_fit_capacity == 0 ? mmap(NULL, length, prot_flags, map_flags, -1, 0)
+        : mremap(g_fit_blocks, old_length, length, MREMAP_MAYMOVE);
+
+    // Case: only the sizes grew - shrink them back, which never moves them
+    if (blocks == MAP_FAILED) {
+        if (g_fit_capacity == 0) {
+            munmap(sizes, length);
+        }
+        else {
+            g_fit_sizes = mremap(sizes, length, old_length, 0);
+        }
+        return false;
+    }
+
+    g_fit_sizes = sizes;
+    g_fit_blocks = blocks;
+    g_fit_capacity = capacity;
+    return true;
+}
+
+/**
+ * @brief      Gets the size fits see for an indexed block: reserved slack shows as 0, so scans pass
+ *              over it without having to look at the header
+ *
+ * @param      block  free block
+ *
+ * @return     block's fit size
+ */
+static inline size_t get_fit_size(struct mem_block *block)
+{
+    return block->reserved ? 0 : block->size;
+}
+
+/**
+ * @brief      Adds a free block to the free index, or refreshes its size if it's already there. If
+ *              the arrays can't grow, the block stays out of the index: it still merges with its
+ *              neighbors, but fits won't hand it out until a later merge gets it indexed.
+ *
+ * @param      block  free block
+ */
+void free_index_add(struct mem_block *block)
+{
+    bool found;
+    size_t slot = free_index_find(block, &found);
+
+    if (found) {
+        g_fit_sizes[slot] = get_fit_size(block);
+        return;
+    }
+
+    if (!free_index_grow()) {
+        return;
+    }
+
+    size_t after = g_fit_count - slot;
+
+    memmove(&g_fit_sizes[slot + 1], &g_fit_sizes[slot], after * sizeof(size_t));
+    memmove(&g_fit_blocks[slot + 1], &g_fit_blocks[slot], after * sizeof(struct mem_block *));
+    g_fit_sizes[slot] = get_fit_size(block);
+    g_fit_blocks[slot] = block;
+    g_fit_count++;
+}
+
+/**
+ * @brief      Takes a block out of the free index
+ *
+ * @param      block  block (does nothing if it isn't indexed)
+ */
+void free_index_remove(struct mem_block *block)
+{
+    bool found;
+    size_t slot = free_index_find(block, &found);
+
+    if (!found) {
+        return;
+    }
+
+    size_t after = g_fit_count - slot - 1;
+
+    memmove(&g_fit_sizes[slot], &g_fit_sizes[slot + 1], after * sizeof(size_t));
+    memmove(&g_fit_blocks[slot], &g_fit_blocks[slot + 1], after * sizeof(struct mem_block *));
+    g_fit_count--;
+}
+
+/**
+ * @brief      Refreshes an indexed block's fit size after it was resized or (un)reserved
+ *
+ * @param      block  block (does nothing if it isn't indexed)
+ */
+void free_index_update(struct mem_block *block)
+{
+    bool found;
+    size_t slot = free_index_find(block, &found);
+
+    if (found) {
+        g_fit_sizes[slot] = get_fit_size(block);
+    }
+}
+
+/**
+ * @brief      Hands an indexed block's slot to the piece split off its end, when the block itself
+ *              is being allocated. Nothing can sit between the two in list order, so the index
+ *              stays sorted without moving any entries.
+ *
+ * @param      block        block leaving the index
+ * @param      replacement  free block split off block's end, or NULL to just remove block
+ */
+void free_index_replace(struct mem_block *block, struct mem_block *replacement)
+{
+    bool found;
+    size_t slot = free_index_find(block, &found);
+
+    if (!found || replacement == NULL) {
+        free_index_remove(block);
+
+        if (replacement != NULL) {
+            free_index_add(replacement);
+        }
+        return;
+    }
+
+    g_fit_sizes[slot] = get_fit_size(replacement);
+    g_fit_blocks[slot] = replacement;
+}
+
+/**
+ * @brief      Gets the name of an instruction set, as accepted by ALLOCATOR_FIT_ISA
+ *
+ * @param[in]  isa   enum fit_isa
+ *
+ * @return     name of the instruction set
+ */
+const char *get_fit_isa_name(int isa)
+{
+    switch (isa) {
+        case FIT_ISA_AVX2:
+            return "avx2";
+        case FIT_ISA_SSE42:
+            return "sse4.2";
+        default:
+            return "scalar";
+    }
+}
+
+/**
+ * @brief      Picks the instruction set for scanning the free index the first time it's needed:
+ *              the best one the CPU supports, or the one named by ALLOCATOR_FIT_ISA if that's
+ *              slower
+ *
+ * @return     enum fit_isa
+ */
+int get_fit_isa(void)
+{
+    if (g_fit_isa >= 0) {
+        return g_fit_isa;
+    }
+
+    int isa = FIT_ISA_SCALAR;
+
+#ifdef __x86_64__
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        isa = FIT_ISA_AVX2;
+    }
+    else if (__builtin_cpu_supports("sse4.2")) {
+        isa = FIT_ISA_SSE42;
+    }
+#endif
+
+    char *setting = getenv("ALLOCATOR_FIT_ISA");
+
+    for (int slower = FIT_ISA_SCALAR; setting != NULL && slower < isa; slower++) {
+        if (strcmp(setting, get_fit_isa_name(slower)) == 0) {
+            isa = slower;
+        }
+    }
+
+    g_fit_isa = isa;
+    g_stats.fit_isa = isa;
+    return isa;
+}
+
+/* Scans over the fit sizes in the free index. Each returns a slot, or count if nothing fits; ties
+ * go to the lowest slot, i.e. the block that comes first in the list. Sizes never reach 2^63, so
+ * the vector versions can use signed 64-bit compares. */
+
+/**
+ * @brief      Finds the first slot holding value
+ *
+ * @param      sizes  fit sizes
+ * @param[in]  count  number of sizes
+ * @param[in]  value  value to look for
+ *
+ * @return     first slot holding value, or count
+ */
+static size_t find_size_scalar(const size_t *sizes, size_t count, size_t value)
+{
+    size_t slot = 0;
+
+    while (slot < count && sizes[slot] != value) {
+        slot++;
+    }
+
+    return slot;
+}
+
+/** @brief      Plain C version of scan_first_fit() */
+static size_t first_fit_scalar(const size_t *sizes, size_t count, size_t size)
+{
+    size_t slot = 0;
+
+    while (slot < count && sizes[slot] < size) {
+        slot++;
+    }
+
+    return slot;
+}
+
+/** @brief      Plain C version of scan_best_fit() */
+static size_t best_fit_scalar(const size_t *sizes, size_t count, size_t size)
+{
+    size_t best = count;
+
+    for (size_t slot = 0; slot < count; slot++) {
+        if (sizes[slot] >= size && (best == count || sizes[slot] < sizes[best])) {
+            best = slot;
+
+            // Case: exact fit - nothing later can beat it
+            if (sizes[slot] == size) {
+                break;
+            }
+        }
+    }
+
+    return best;
+}
+
+/** @brief      Plain C version of scan_worst_fit() */
+static size_t worst_fit_scalar(const size_t *sizes, size_t count, size_t size)
+{
+    size_t worst = count;
+
+    for (size_t slot = 0; slot < count; slot++) {
+        if (sizes[slot] >= size && (worst == count || sizes[slot] > sizes[worst])) {
+            worst = slot;
+        }
+    }
+
+    return worst;
+}
+
+// The vector scans load size_t as 64-bit lanes, so they're x86-64 only. 32-bit x86 scans in C.
+#ifdef __x86_64__
+
+/** @brief      SSE4.2 version of find_size_scalar() */
+__attribute__((target("sse4.2")))
+static size_t find_size_sse42(const size_t *sizes, size_t count, size_t value)
+{
+    const __m128i wanted = _mm_set1_epi64x((long long) value);
+    size_t slot = 0;
+
+    for (; slot + 2 <= count; slot += 2) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *) &sizes[slot]);
+        int hits = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(chunk, wanted)));
+
+        if (hits != 0) {
+            return slot + __builtin_ctz(hits);
+        }
+    }
+
+    return slot + find_size_scalar(sizes + slot, count - slot, value);
+}
+
+/** @brief      SSE4.2 version of scan_first_fit() */
+__attribute__((target("sse4.2")))
+static size_t first_fit_sse42(const size_t *sizes, size_t count, size_t size)
+{
+    const __m128i too_small = _mm_set1_epi64x((long long) size - 1);
+    size_t slot = 0;
+
+    for (; slot + 2 <= count; slot += 2) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *) &sizes[slot]);
+        int hits = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(chunk, too_small)));
+
+        if (hits != 0) {
+            return slot + __builtin_ctz(hits);
+        }
+    }
+
+    return slot + first_fit_scalar(sizes + slot, count - slot, size);
+}
+
+/** @brief      SSE4.2 version of scan_best_fit() */
+__attribute__((target("sse4.2")))
+static size_t best_fit_sse42(const size_t *sizes, size_t count, size_t size)
+{
+    const __m128i too_small = _mm_set1_epi64x((long long) size - 1);
+    const __m128i exact = _mm_set1_epi64x((long long) size);
+    const __m128i none = _mm_set1_epi64x(LLONG_MAX);
+    __m128i best = none;
+    size_t slot = 0;
+
+    for (; slot + 2 <= count; slot += 2) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *) &sizes[slot]);
+        int hits = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(chunk, exact)));
+
+        if (hits != 0) {
+            return slot + __builtin_ctz(hits);
+        }
+
+        __m128i fits = _mm_blendv_epi8(none, chunk, _mm_cmpgt_epi64(chunk, too_small));
+        best = _mm_blendv_epi8(best, fits, _mm_cmpgt_epi64(best, fits));
+    }
+
+    long long lanes[2];
+    _mm_storeu_si128((__m128i *) lanes, best);
+    size_t smallest = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+
+    for (; slot < count; slot++) {
+        if (sizes[slot] == size) {
+            return slot;
+        }
+        if (sizes[slot] >= size && sizes[slot] < smallest) {
+            smallest = sizes[slot];
+        }
+    }
+
+    return smallest == LLONG_MAX ? count : find_size_sse42(sizes, count, smallest);
+}
+
+/** @brief      SSE4.2 version of scan_worst_fit() */
+__attribute__((target("sse4.2")))
+static size_t worst_fit_sse42(const size_t *sizes, size_t count, size_t size)
+{
+    __m128i worst = _mm_setzero_si128();
+    size_t slot = 0;
+
+    for (; slot + 2 <= count; slot += 2) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *) &sizes[slot]);
+        worst = _mm_blendv_epi8(worst, chunk, _mm_cmpgt_epi64(chunk, worst));
+    }
+
+    long long lanes[2];
+    _mm_storeu_si128((__m128i *) lanes, worst);
+    size_t largest = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+
+    for (; slot < count; slot++) {
+        if (sizes[slot] > largest) {
+            largest = sizes[slot];
+        }
+    }
+
+    return largest < size ? count : find_size_sse42(sizes, count, largest);
+}
+
+/** @brief      AVX2 version of find_size_scalar() */
+__attribute__((target("avx2")))
+static size_t find_size_avx2(const size_t *sizes, size_t count, size_t value)
+{
+    const __m256i wanted = _mm256_set1_epi64x((long long) value);
+    size_t slot = 0;
+
+    for (; slot + 4 <= count; slot += 4) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *) &sizes[slot]);
+        int hits = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(chunk, wanted)));
+
+        if (hits != 0) {
+            return slot + __builtin_ctz(hits);
+        }
+    }
+
+    return slot + find_size_scalar(sizes + slot, count - slot, value);
+}
+
+/** @brief      AVX2 version of scan_first_fit() */
+__attribute__((target("avx2")))
+static size_t first_fit_avx2(const size_t *sizes, size_t count, size_t size)
+{
+    const __m256i too_small = _mm256_set1_epi64x((long long) size - 1);
+    size_t slot = 0;
+
+    for (; slot + 4 <= count; slot += 4) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *) &sizes[slot]);
+        int hits = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(chunk, too_small)));
+
+        if (hits != 0) {
+            return slot + __builtin_ctz(hits);
+        }
+    }
+
+    return slot + first_fit_scalar(sizes + slot, count - slot, size);
+}
+
+/** @brief      AVX2 version of scan_best_fit() */
+__attribute__((target("avx2")))
+static size_t best_fit_avx2(const size_t *sizes, size_t count, size_t size)
+{
+    const __m256i too_small = _mm256_set1_epi64x((long long) size - 1);
+    const __m256i exact = _mm256_set1_epi64x((long long) size);
+    const __m256i none = _mm256_set1_epi64x(LLONG_MAX);
+    __m256i best = none;
+    size_t slot = 0;
+
+    for (; slot + 4 <= count; slot += 4) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *) &sizes[slot]);
+        int hits = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(chunk, exact)));
+
+        if (hits != 0) {
+            return slot + __builtin_ctz(hits);
+        }
+
+        __m256i fits = _mm256_blendv_epi8(none, chunk, _mm256_cmpgt_epi64(chunk, too_small));
+        best = _mm256_blendv_epi8(best, fits, _mm256_cmpgt_epi64(best, fits));
+    }
+
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i *) lanes, best);
+    size_t smallest = LLONG_MAX;
+
+    for (int lane = 0; lane < 4; lane++) {
+        if ((size_t) lanes[lane] < smallest) {
+            smallest = lanes[lane];
+        }
+    }
+
+    for (; slot < count; slot++) {
+        if (sizes[slot] == size) {
+            return slot;
+        }
+        if (sizes[slot] >= size && sizes[slot] < smallest) {
+            smallest = sizes[slot];
+        }
+    }
+
+    return smallest == LLONG_MAX ? count : find_size_avx2(sizes, count, smallest);
+}
+
+/** @brief      AVX2 version of scan_worst_fit() */
+__attribute__((target("avx2")))
+static size_t worst_fit_avx2(const size_t *sizes, size_t count, size_t size)
+{
+    __m256i worst = _mm256_setzero_si256();
+    size_t slot = 0;
+
+    for (; slot + 4 <= count; slot += 4) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *) &sizes[slot]);
+        worst = _mm256_blendv_epi8(worst, chunk, _mm256_cmpgt_epi64(chunk, worst));
+    }
+
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i *) lanes, worst);
+    size_t largest = 0;
+
+    for (int lane = 0; lane < 4; lane++) {
+        if ((size_t) lanes[lane] > largest) {
+            largest = lanes[lane];
+        }
+    }
+
+    for (; slot < count; slot++) {
+        if (sizes[slot] > largest) {
+            largest = sizes[slot];
+        }
+    }
+
+    return largest < size ? count : find_size_avx2(sizes, count, largest);
+}
+
+#endif
+
+/**
+ * @brief      Finds the first slot whose fit size is at least size
+ *
+ * @param      sizes  fit sizes
+ * @param[in]  count  number of sizes
+ * @param[in]  size   size being searched for (includes header)
+ *
+ * @return     slot, or count if nothing fits
+ */
+size_t scan_first_fit(const size_t *sizes, size_t count, size_t size)
+{
+    switch (get_fit_isa()) {
+#ifdef __x86_64__
+        case FIT_ISA_AVX2:
+            return first_fit_avx2(sizes, count, size);
+        case FIT_ISA_SSE42:
+            return first_fit_sse42(sizes, count, size);
+#endif
+        default:
+            return first_fit_scalar(sizes, count, size);
+    }
+}
+
+/**
+ * @brief      Finds the first slot with the smallest fit size that is at least size. Stops at the
+ *              first exact fit.
+ *
+ * @param      sizes  fit sizes
+ * @param[in]  count  number of sizes
+ * @param[in]  size   size being searched for (includes header)
+ *
+ * @return     slot, or count if nothing fits
+ */
+size_t scan_best_fit(const size_t *sizes, size_t count, size_t size)
+{
+    switch (get_fit_isa()) {
+#ifdef __x86_64__
+        case FIT_ISA_AVX2:
+            return best_fit_avx2(sizes, count, size);
+        case FIT_ISA_SSE42:
+            return best_fit_sse42(sizes, count, size);
+#endif
+        default:
+            return best_fit_scalar(sizes, count, size);
+    }
+}
+
+/**
+ * @brief      Finds the first slot with the largest fit size, if that is at least size
+ *
+ * @param      sizes  fit sizes
+ * @param[in]  count  number of sizes
+ * @param[in]  size   size being searched for (includes header)
+ *
+ * @return     slot, or count if nothing fits
+ */
+size_t scan_worst_fit(const size_t *sizes, size_t count, size_t size)
+{
+    switch (get_fit_isa()) {
+#ifdef __x86_64__
+        case FIT_ISA_AVX2:
+            return worst_fit_avx2(sizes, count, size);
+        case FIT_ISA_SSE42:
+            return worst_fit_sse42(sizes, count, size);
+#endif
+        default:
+            return worst_fit_scalar(sizes, count, size);
+    }
+}
+
+/**
+ * @brief      Gets the block in a slot a fit picked, and remembers the slot so the index updates
+ *              that follow don't have to search for it
+ *
+ * @param[in]  slot  slot returned by a scan
+ *
+ * @return     the block, or NULL if slot is past the end (nothing fit)
+ */
+static inline struct mem_block *get_fit_block(size_t slot)
+{
+    if (slot >= g_fit_count) {
+        return NULL;
+    }
+
+    g_fit_hint = slot;
+    return g_fit_blocks[slot];
+}
+
+/**
+ * Given a block size (header + data), locate a suitable location using the
+ * first fit free space management algorithm.
+ *
+ * @param size size of the block (header + data)
+ */
+/**
+ * @brief      Given a block size (header + data), locate a suitable location using the
+ *              first fit free space management algorithm.
+ *
+ * @param[in]  size  size of the block (header + data)
+ *
+ * @return     First matching block, or NULL if no match
+ * 
+ * @note       brief and params are Prof. Matthew's words. Same with best_fit and worst_fit. Also Prof. Matthew's words: "If you get segfault here - probably something else is wrong"
+ */
+FIT_INLINE void *first_fit(size_t size)
+{
+    LOGP("START FIRST_FIT------------------------------------------------------------------\n");
+    size_t slot = scan_first_fit(g_fit_sizes, g_fit_count, size);
+
+    g_stats.fit_steps += slot < g_fit_count ? slot + 1 : g_fit_count;
+    LOGP("DONE FIRST_FIT------------------------------------------------------------------\n");
+    return get_fit_block(slot);
+}
+
+/**
+ * Given a block size (header + data), locate a suitable location using the
+ * worst fit free space management algorithm. If there are ties (i.e., you find
+ * multiple worst fit candidates with the same size), use the first candidate
+ * found.
+ *
+ * @param size size of the block (header + data)
+ */
+
+/**
+ * @brief       Given a block size (header + data), locate a suitable location using the
+ *              worst fit free space management algorithm. If there are ties (i.e., you find
+ *              multiple worst fit candidates with the same size), use the first candidate
+ *              found.
+ * @param[in]  size  size of the block (header + data)
+ *
+ * @return     Pointer to worst fitting block
+ * 
+ * @note       See first_fit note
+ */
+FIT_INLINE void *worst_fit(size_t size)
+{
+    size_t slot = scan_worst_fit(g_fit_sizes, g_fit_count, size);
+
+    g_stats.fit_steps += g_fit_count;
+    return get_fit_block(slot);
+}
+
+/**
+
+ *
+ * @param size size of the block (header + data)
+ */
+/**
+ * @brief       Given a block size (header + data), locate a suitable location using the
+ *              best fit free space management algorithm. If there are ties (i.e., you find
+ *              multiple best fit candidates with the same size), use the first candidate
+ *              found.
+ *
+ * @param[in]  size  size of the block (header + data)
+ *
+ * @return     best fitting header
+ * 
+ * @note       See first_fit note
+ */
+FIT_INLINE void *best_fit(size_t size)
+{
+    size_t slot = scan_best_fit(g_fit_sizes, g_fit_count, size);
+
+    // Case: exact fit - the scan stopped there
+    g_stats.fit_steps += slot < g_fit_count && g_fit_sizes[slot] == size ? slot + 1 : g_fit_count;
+    return get_fit_block(slot);
+}
+
+/**
+ * @brief      Runs the free space management algorithm identified by policy
+ *
+ * @param[in]  policy  FIT_FIRST, FIT_BEST or FIT_WORST
+ * @param[in]  size    size of the block (header + data)
+ *
+ * @return     block chosen by the algorithm, or NULL if no match
+ */
+void *fit_with_policy(int policy, size_t size)
+{
+    switch (policy) {
+        case FIT_BEST:
+            return best_fit(size);
+        case FIT_WORST:
+            return worst_fit(size);
+        default:
+            return first_fit(size);
+    }
+}
+
+/**
+ * @brief      Finds the first piece of reserved slack that can hold size. Reserved blocks have a
+ *              fit size of 0, so only this looks at their real size.
+ *
+ * @param[in]  size  size of the block (header + data)
+ *
+ * @return     reserved block, or NULL if none is big enough
+ */
+void *claim_reserved_fit(size_t size)
+{
+    for (size_t slot = 0; slot < g_fit_count; slot++) {
+        if (g_fit_sizes[slot] == 0 && g_fit_blocks[slot]->size >= size) {
+            g_stats.fit_steps += slot + 1;
+            return get_fit_block(slot);
+        }
+    }
+
+    g_stats.fit_steps += g_fit_count;
+    return NULL;
+}
+
+/**
+ * @brief      Gets the name of a fit policy, as accepted by ALLOCATOR_ALGORITHM
+ *
+ * @param[in]  policy  policy
+ *
+ * @return     name of the policy
+ */
+const char *get_fit_policy_name(int policy)
+{
+    switch (policy) {
+        case FIT_BEST:
+            return "best_fit";
+        case FIT_WORST:
+            return "worst_fit";
+        default:
+            return "first_fit";
+    }
+}
+
+/**
+ * @brief      Closes the current window of a size class: measures how fragmented the heap is and
+ *              how long searches were, then decides which algorithm the class should use next.
+ *              - first_fit moves to best_fit once free space is badly fragmented, or when its
+ *                searches walk far past blocks that are too small while fragmentation is building.
+ *              - best_fit moves to worst_fit when it keeps leaving slivers too small to serve the
+ *                class, and back to first_fit once fragmentation has dropped.
+ *              - worst_fit moves back to first_fit once fragmentation has dropped, or to best_fit
+ *                if the slivers are gone but fragmentation is still high.
+ *
+ * @param[in]  size_class  size class (see get_size_bucket())
+ */
+void adapt_fit_policy(int size_class)
+{
+    struct fit_class_stats *class_stats = &g_stats.fit_classes[size_class];
+    struct fit_window *window = &g_fit_windows[size_class];
+
+    size_t class_min = (size_t) 1 << size_class;
+    size_t total_free = 0;
+    size_t largest_free = 0;
+    size_t free_blocks = 0;
+    size_t slivers = 0;
+
+    // Reserved slack has a fit size of 0: fits can't use it, so it isn't counted as free here
+    for (size_t slot = 0; slot < g_fit_count; slot++) {
+        size_t size = g_fit_sizes[slot];
+
+        if (size == 0) {
+            continue;
+        }
+
+        total_free += size;
+        free_blocks++;
+
+        if (size > largest_free) {
+            largest_free = size;
+        }
+        if (size < class_min) {
+            slivers++;
+        }
+    }
+
+    double fragmentation = total_free > 0 ? 1.0 - (double) largest_free / total_free : 0.0;
+    double sliver_ratio = free_blocks > 0 ? (double) slivers / free_blocks : 0.0;
+    double search_length = (double) window->steps / window->allocations;
+
+    int policy = class_stats->policy;
+
+    switch (policy) {
+        case FIT_FIRST:
+            if (fragmentation > ADAPTIVE_FRAG_HIGH
+                    || (search_length > ADAPTIVE_SEARCH_LONG && fragmentation > ADAPTIVE_FRAG_LOW)) {
+                policy = FIT_BEST;
+            }
+            break;
+        case FIT_BEST:
+            if (fragmentation < ADAPTIVE_FRAG_LOW) {
+                policy = FIT_FIRST;
+            }
+            else if (fragmentation > ADAPTIVE_FRAG_HIGH && sliver_ratio > ADAPTIVE_SLIVER_HIGH) {
+                policy = FIT_WORST;
+            }
+            break;
+        case FIT_WORST:
+            if (fragmentation < ADAPTIVE_FRAG_LOW) {
+                policy = FIT_FIRST;
+            }
+            else if (fragmentation > ADAPTIVE_FRAG_HIGH && sliver_ratio < ADAPTIVE_SLIVER_LOW) {
+                policy = FIT_BEST;
+            }
+            break;
+    }
+
+    LOG("class %d: search %.1f, fragmentation %.2f, slivers %.2f: %s -> %s\n",
+            size_class, search_length, fragmentation, sliver_ratio,
+            get_fit_policy_name(class_stats->policy), get_fit_policy_name(policy));
+
+    if (policy != class_stats->policy) {
+        class_stats->previous_policy = class_stats->policy;
+        class_stats->policy = policy;
+        class_stats->switches++;
+    }
+
+    class_stats->windows++;
+    class_stats->search_length = search_length;
+    class_stats->fragmentation = fragmentation;
+    class_stats->sliver_ratio = sliver_ratio;
+
+    window->allocations = 0;
+    window->steps = 0;
+}
+
+/**
+ * @brief      Given a block size (header + data), locate a suitable location using whichever of
+ *              first, best or worst fit currently works best for the request's size class. Every
+ *              ADAPTIVE_WINDOW allocations in a class, the choice is re-evaluated by
+ *              adapt_fit_policy().
+ *
+ * @param[in]  size  size of the block (header + data)
+ *
+ * @return     matching block, or NULL if no match
+ */
+FIT_INLINE void *adaptive_fit(size_t size)
+{
+    int size_class = get_size_bucket(size);
+    struct fit_window *window = &g_fit_windows[size_class];
+
+    unsigned long steps_before = g_stats.fit_steps;
+    void *found = fit_with_policy(g_stats.fit_classes[size_class].policy, size);
+
+    g_stats.fit_classes[size_class].allocations++;
+    window->steps += g_stats.fit_steps - steps_before;
+    window->allocations++;
+
+    if (window->allocations >= ADAPTIVE_WINDOW) {
+        adapt_fit_policy(size_class);
+    }
+
+    return found;
+}
+
+/**
+ * @brief      Runs the algorithm selected by ALLOCATOR_ALGORITHM (or make POLICY=...)
+ *
+ * @param[in]  size     requested size (includes header)
+ * @param[in]  counted  false for a retry of the same request: adaptive then searches with the
+ *                      class's current algorithm without adding to its window
+ *
+ * @return     block chosen by the algorithm, or NULL if no match
+ */
+FIT_INLINE void *find_fit(size_t size, bool counted)
+{
+#ifdef FIXED_FIT
+    // Case: algorithm fixed at compile time (make POLICY=...) - a direct call the compiler inlines.
+    // The casts keep gcc from flagging the comparison as always false when POLICY=adaptive.
+    if (counted || (uintptr_t) FIXED_FIT != (uintptr_t) adaptive_fit) {
+        return FIXED_FIT(size);
+    }
+#else
+    char *algo = getenv("ALLOCATOR_ALGORITHM");
+    if (algo == NULL) {
+        algo = "first_fit";
+    }
+
+    if (strcmp(algo, "first_fit") == 0){
+        return first_fit(size);
+    }
+    else if (strcmp(algo, "best_fit") == 0) {
+        return best_fit(size);
+    }
+    else if (strcmp(algo, "worst_fit") == 0) {
+        return worst_fit(size);
+    }
+    else if (strcmp(algo, "adaptive") != 0) {
+        return NULL;
+    }
+    else if (counted) {
+        return adaptive_fit(size);
+    }
+#endif
+
+    // Case: adaptive retry - same algorithm as the first try, outside the class's window
+    return fit_with_policy(g_stats.fit_classes[get_size_bucket(size)].policy, size);
+}
+
+/**
+ * @brief      Hands out a block found by a fit: splits off what the request doesn't need and marks
+ *              the rest used
+ *
+ * @param      found  free block, or NULL
+ * @param[in]  size   requested size (includes header)
+ *
+ * @return     found, or NULL if found is NULL
+ */
+FIT_INLINE void *take_fit(struct mem_block *found, size_t size)
+{
+    if (found == NULL) {
+        return NULL;
+    }
+
+    struct mem_region *region = pagemap_lookup(found);
+
+    unpurge_block(found);
+    struct mem_block* new_head = split_block(found, size); // Note - only split if you actually can split block
+
+    if (new_head != NULL) {
+        new_head->region_id = found->region_id;
+        new_head->free = true;
+        //ll_add(found, new_head);
+    }
+
+    found->free = false;
+    free_index_replace(found, new_head);
+    region_used_run(region, found->size);
+    region->live++;
+    return found;
+}
+
+/**
+ * @brief      Finds the best-suiting block and returns it, based on what FSM algorithm is being used.
+ *
+ * @param[in]  size  requested size (includes header)
+ *
+ * @return     best-suiting block based on FSM algorithm, or NULL if no suitable block
+ * 
+ * @note       Description based off Prof. Matthew's description of this function
+ */
+FIT_INLINE void *reuse(size_t size)
+{
+    g_stats.fit_searches++;
+
+    struct mem_block* found = find_fit(size, true);
+
+    // Case: nothing fit - before the caller maps a new region, take back slack reserved for
+    // growing allocations
+    if (found == NULL && g_reserved_blocks > 0) {
+        found = claim_reserved_fit(size);
+
+        if (found != NULL) {
+            unreserve_block(found);
+            g_stats.slack_reclaims++;
+        }
+    }
+
+    return take_fit(found, size);
+}
+
+/**
+ * @brief      Allocates memory with initalizing. If ALLOCATOR_SCRIBBLE environment var is set to 1, will initalize every byte to
+ *              0XAA to, as Apple puts it, "increase the chance that a program making assumptions about newly allocated memory fails" 
+ *
+ * @param[in]  size  size (not including header)
+ *
+ * @return     A block of data with its size = size
+ *
+ * @note       Does the work for malloc(), which only adds latency tracking on top. Leaves the code path
+ *              taken in t_outcome.
+ */
+void *malloc_internal(size_t size)
+{
+    // Sampling costs a single decrement until the countdown runs out
+    if (--t_sample_countdown <= 0) {
+        void *sampled = sample_allocation(size);
+
+        if (sampled != NULL) {
+            t_outcome = OUTCOME_GUARDED;
+            return sampled;
+        }
+    }
+
+    // Case: small request - try the thread's magazines before taking alloc_mutex
+    if (size <= MAGAZINE_MAX_SIZE) {
+        size_t cached_size = get_aligned_size(size + sizeof(struct mem_block));
+        struct mem_block *cached = magazine_alloc(cached_size);
+
+        if (cached != NULL) {
+            scribble_if_requested(cached, cached_size);
+            t_outcome = OUTCOME_MAGAZINE;
+            return cached + 1;
+        }
+    }
+
+    pthread_mutex_lock(&alloc_mutex);
+    /* Lovingly ripped from lab code */
+
+
+    /* REGION: Get real size */
+    size_t real_size = get_aligned_size(size + sizeof(struct mem_block));
+   
+    /* REGION: REUSING A REGION */
+    // Error - not actually getting anything from reuse()???
+    struct mem_block* reused_block = reuse(real_size);
+    size_t region_size = get_region_size(real_size + REGION_BLOCK_OFFSET);
+
+    // Case: nothing fit, and another region would take the heap past the soft watermark - give
+    // free memory back first. Merging slack on the way may also have made room. The retry is the
+    // same search, so it isn't counted again, and the slack it could claim has just been merged.
+    if (reused_block == NULL && under_pressure(region_size) && relieve_pressure(region_size)) {
+        reused_block = take_fit(find_fit(real_size, false), real_size);
+    }
+
+    g_stats.allocations++;
+
+    if (reused_block != NULL) {
+        LOGP("ba\n");
+        sprintf(reused_block->name, "Allocation %d", g_allocations++);
+        reused_block->reallocs = 0;
+        scribble_if_requested(reused_block, real_size);
+        pthread_mutex_unlock(&alloc_mutex);
+
+        t_outcome = OUTCOME_LIST;
+        return reused_block + 1;
+    }
+
+    t_outcome = OUTCOME_NEW_REGION;
+
+    // Case: purging couldn't keep the heap under the limit. Failing here wouldn't save the process
+    // (the limit covers more than our heap), so map anyway and let the stats say so.
+    if (g_stats.mem_limit != 0 && get_heap_usage() + region_size > g_stats.mem_limit) {
+        g_stats.limit_events++;
+    }
+
+    struct mem_block *new_block = grow_heap(real_size);
+
+    if (new_block == NULL) {
+        pthread_mutex_unlock(&alloc_mutex);
+        return NULL;
+    }
+
+    struct mem_region *region = pagemap_lookup(new_block);
+
+    struct mem_block *rest = split_block(new_block, real_size);
+    new_block->free = false;
+    new_block->reallocs = 0;
+    free_index_replace(new_block, rest);
+    region_used_run(region, new_block->size);
+    region->live++;
+
+    scribble_if_requested(new_block, real_size);
+    sprintf(new_block->name, "Allocation %d", g_allocations++);
+    pthread_mutex_unlock(&alloc_mutex);
+    return new_block + 1; // block is the memory header; block + 1 is the actual data
+}
+
+/**
+ * @brief      Literally the same as malloc, but writes a custom name in the header
+ *
+ * @param[in]  size  requested size
+ * @param      name  name to write in header
+ *
+ * @return     Block of data with its size = size
+ */
+void *malloc_name(size_t size, char *name)
+{
+    void* block = malloc(size);
+    struct mem_region *region = pagemap_lookup(block);
+
+    // Guarded allocations have no header to name
+    if (region != NULL && region->kind == REGION_HEAP) {
+        struct mem_block* head = get_header_from_data(block);
+        strcpy(head->name, name);
+    }
+
+    return block;
+}
+
+/**
+ * @brief      If ALLOCATOR_SCRIBBLE enviornment var is set to 1, sets every byte in block to 0XAA to, as 
+ *              Apple puts it in its own scribbler, "increase the chance that programs that make certain
+ *              assumptions about uninitialized memory fail"
+ *
+ * @param      head header of block
+ * @param[in]  real_size  real size, including header size
+ */
+void scribble_if_requested(struct mem_block *head, size_t real_size)
+{
+    char *scribble = getenv("ALLOCATOR_SCRIBBLE");
+
+    if (scribble != NULL && strcmp(scribble, "1") == 0) {
+        memset(get_data_from_header(head), 0XAA, real_size - sizeof(struct mem_block));
+    }
+}
+
+/**
+ * @brief      Turns a freshly registered region into a single free block at the tail of the list,
+ *              and appends the region to the region list
+ *
+ * @param      region  region (its whole mapping, past REGION_BLOCK_OFFSET, becomes the block)
+ *
+ * @return     the new block
+ */
+struct mem_block *add_region_block(struct mem_region *region)
+{
+    struct mem_block *new_block = (struct mem_block *) ((char *) region->base + REGION_BLOCK_OFFSET);
+
+    if (g_head == NULL && g_tail == NULL) {
+        g_head = new_block;
+        g_tail = g_head;
+        new_block->prev = NULL;
+        g_blocks++;
+    }
+    else {
+        ll_add(g_tail, new_block);
+        g_tail = new_block;
+        g_tail->next = NULL;
+    }
+
+    new_block->region_id = region->id;
+    new_block->magic = BLOCK_MAGIC;
+    g_stats.regions_mapped++;
+    new_block->free = true;
+    new_block->reserved = false;
+    new_block->purged = false;
+    new_block->size = region->size - REGION_BLOCK_OFFSET;
+    new_block->next = NULL;
+
+    region->live = 0;
+    region->free_bytes = new_block->size;
+    g_free_bytes += new_block->size;
+    g_stats.mapped_bytes += region->size;
+    region->prev = g_last_region;
+    region->next = NULL;
+
+    if (g_last_region != NULL) {
+        g_last_region->next = region;
+    }
+    else {
+        g_first_region = region;
+    }
+    g_last_region = region;
+
+    free_index_add(new_block);
+    return new_block;
+}
+
+/**
+ * @brief      Reads an environment variable holding a byte count with an optional K, M or G suffix
+ *              (powers of 1024), such as "4096", "512K" or "1G". Anything else (a sign, an unknown
+ *              suffix, trailing characters, or a value too big for size_t) is reported and ignored,
+ *              so the caller's default applies.
+ *
+ * @param[in]  name   environment variable
+ * @param[out] bytes  number of bytes; left alone unless the variable holds a valid size
+ *
+ * @return     true if the variable is set to a valid size
+ */
+bool parse_size(const char *name, size_t *bytes)
+{
+    char *setting = getenv(name);
+
+    if (setting == NULL || setting[0] == '\0') {
+        return false;
+    }
+
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(setting, &end, 10);
+    int shift = 0;
+
+    switch (*end) {
+        case 'g': case 'G':
+            shift = 30;
+            end++;
+            break;
+        case 'm': case 'M':
+            shift = 20;
+            end++;
+            break;
+        case 'k': case 'K':
+            shift = 10;
+            end++;
+            break;
+    }
+
+    // Case: strtoull() would have taken "-1" as ULLONG_MAX
+    if (setting[0] < '0' || setting[0] > '9' || *end != '\0' || errno == ERANGE
+            || value > SIZE_MAX >> shift) {
+        report_error("%s: ignoring invalid size \"%s\"\n", name, setting);
+        return false;
+    }
+
+    *bytes = (size_t) value << shift;
+    return true;
+}
+
+/**
+ * @brief      If ALLOCATOR_RESERVE is set, maps that many bytes up front as one retained region
+ *              of free space, so a warmed-up process doesn't need mmap() to serve its first
+ *              requests. With ALLOCATOR_PREFAULT=1 the pages are also faulted in right away
+ *              (MAP_POPULATE). The region is never unmapped, even when it's empty.
+ */
+void init_reserve(void)
+{
+    size_t reserve = 0;
+
+    if (!parse_size("ALLOCATOR_RESERVE", &reserve) || reserve == 0) {
+        return;
+    }
+
+    char *prefault = getenv("ALLOCATOR_PREFAULT");
+    size_t region_size = get_region_size(reserve);
+    int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    if (prefault != NULL && strcmp(prefault, "1") == 0) {
+        map_flags |= MAP_POPULATE;
+    }
+
+    void *base = mmap(NULL, region_size, PROT_READ | PROT_WRITE, map_flags, -1, 0);
+
+    if (base == MAP_FAILED) {
+        report_error("ALLOCATOR_RESERVE: could not map %zu bytes\n", region_size);
+        return;
+    }
+
+    pthread_mutex_lock(&alloc_mutex);
+
+    struct mem_region *region = register_region(base, region_size, REGION_HEAP);
+
+    if (region == NULL) {
+        pthread_mutex_unlock(&alloc_mutex);
+        munmap(base, region_size);
+        return;
+    }
+
+    region->retained = true;
+    add_region_block(region);
+    g_stats.reserved_bytes += region_size;
+
+    pthread_mutex_unlock(&alloc_mutex);
+}
+
+/**
+ * @brief      Maps a new region and returns the start as a header
+ *
+ * @param[in]  real_size  size, including header size
+ *
+ * @return     pointer to start/header of mapped region
+ */
+struct mem_block *map_new_region(size_t real_size)
+{
+    size_t region_size = get_region_size(real_size);
+    const int prot_flags = PROT_READ | PROT_WRITE;
+    const int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    return (struct mem_block *) mmap(NULL, region_size, prot_flags, map_flags, -1, 0);
+}
+/**
+ * @brief      Gets the last block of a heap region: the one before the next region's first block,
+ *              or the tail of the list
+ *
+ * @param      region  heap region
+ *
+ * @return     last block in the region
+ */
+struct mem_block *get_last_block(struct mem_region *region)
+{
+    return region->next != NULL ? get_first_block(region->next)->prev : g_tail;
+}
+
+/**
+ * @brief      Adds freshly mapped pages that sit right before or right after a heap region to that
+ *              region, so the free space can merge across what used to be the boundary. The block
+ *              on the region's side of the boundary must be available (see block_is_available()).
+ *
+ * @param      region  heap region
+ * @param      start   start of the new pages, which end at region->base or start at its end
+ * @param[in]  length  size of the new pages
+ *
+ * @return     free block that now covers the new pages, or NULL if the page map couldn't be
+ *              extended (the region is left as it was)
+ */
+struct mem_block *extend_region(struct mem_region *region, char *start, size_t length)
+{
+    if (!pagemap_set(start, length, region)) {
+        pagemap_set(start, length, NULL);
+        return NULL;
+    }
+
+    g_stats.mapped_bytes += length;
+
+    // Case: pages after the region - its last block is free, so it just gets bigger
+    if (start == (char *) region->base + region->size) {
+        struct mem_block *last = get_last_block(region);
+
+        region->size += length;
+        unpurge_block(last);
+        last->size += length;
+        free_index_update(last);
+        region_freed_run(region, length);
+        return last;
+    }
+
+    // Case: pages before the region - they take over its leading REGION_BLOCK_OFFSET bytes, and a
+    // new first block runs up to the old first block
+    struct mem_block *first = get_first_block(region);
+
+    region->base = start;
+    region->size += length;
+
+    struct mem_block *block = get_first_block(region);
+    block->size = length;
+
+    if (first->prev != NULL) {
+        ll_add(first->prev, block);
+    }
+    else {
+        block->prev = NULL;
+        block->next = first;
+        first->prev = block;
+        g_head = block;
+        g_blocks++;
+    }
+
+    block->magic = BLOCK_MAGIC;
+    block->region_id = region->id;
+    block->free = true;
+    block->reserved = false;
+    block->purged = false;
+    block->reallocs = 0;
+
+    block = merge_block(block);
+    region_freed_run(region, length);
+
+    return block;
+}
+
+/**
+ * @brief      Gets new memory for an allocation nothing in the heap could hold. If the tail region
+ *              ends in free space, it's grown in place first by mapping only the pages that block
+ *              is short of right after it (MAP_FIXED_NOREPLACE refuses if anything is there).
+ *              Failing that, a region's worth of pages is mapped wherever the kernel likes; if they
+ *              land next to a heap region whose free space reaches the boundary, they join that
+ *              region. Otherwise they become a region of their own. Regions are only joined where
+ *              free space merges across the boundary, since a bigger region is unmapped
+ *              as a whole less often.
+ *
+ * @param[in]  real_size  size needed (includes header)
+ *
+ * @return     free block of at least real_size, or NULL if memory ran out
+ */
+struct mem_block *grow_heap(size_t real_size)
+{
+    size_t length = get_region_size(real_size + REGION_BLOCK_OFFSET);
+    struct mem_block *block;
+
+    if (g_last_region != NULL && block_is_available(g_tail) && g_tail->size < real_size) {
+        char *end = (char *) g_last_region->base + g_last_region->size;
+        size_t missing = get_region_size(real_size - g_tail->size);
+        char *pages = mmap(end, missing, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+        if (pages == end && (block = extend_region(g_last_region, pages, missing)) != NULL) {
+            g_stats.regions_extended++;
+            return block;
+        }
+
+        // Case: the kernel ignored the hint (no MAP_FIXED_NOREPLACE) and put the pages elsewhere
+        if (pages != MAP_FAILED) {
+            munmap(pages, missing);
+        }
+    }
+
+    char *base = (char *) map_new_region(real_size + REGION_BLOCK_OFFSET);
+
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    struct mem_region *below = pagemap_lookup(base - 1);
+    struct mem_region *above = pagemap_lookup(base + length);
+
+    if (below != NULL && below->kind == REGION_HEAP && (char *) below->base + below->size == base
+            && block_is_available(get_last_block(below))
+            && (block = extend_region(below, base, length)) != NULL) {
+        g_stats.mappings_merged++;
+        return block;
+    }
+    if (above != NULL && above->kind == REGION_HEAP && above->base == base + length
+            && block_is_available(get_first_block(above))
+            && (block = extend_region(above, base, length)) != NULL) {
+        g_stats.mappings_merged++;
+        return block;
+    }
+
+    struct mem_region *region = register_region(base, length, REGION_HEAP);
+
+    // Case: page map couldn't be extended - give the mapping back rather than hand out untracked memory
+    if (region == NULL) {
+        munmap(base, length);
+        return NULL;
+    }
+
+    return add_region_block(region);
+}
+
+
+/**
+ * @brief      Reads a small file (e.g. from /proc or /sys) into buf without going through stdio,
+ *              which may call back into malloc()
+ *
+ * @param[in]  path  file to read
+ * @param      buf   where to store the contents, NUL-terminated
+ * @param[in]  size  size of buf
+ *
+ * @return     bytes read, or -1 if the file couldn't be opened
+ */
+ssize_t read_small_file(const char *path, char *buf, size_t size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) {
+        return -1;
+    }
+
+    size_t total = 0;
+    ssize_t count;
+
+    while (total < size - 1 && (count = read(fd, buf + total, size - 1 - total)) > 0) {
+        total += count;
+    }
+
+    close(fd);
+    buf[total] = '\0';
+    return total;
+}
+
+/**
+ * @brief      Finds the memory limit of the cgroup we run in. With cgroup v2, the tightest
+ *              memory.max from our group up to the root applies; otherwise the cgroup v1
+ *              memory.limit_in_bytes is used.
+ *
+ * @return     limit in bytes, or 0 if there is none (or it can't be read)
+ */
+size_t read_cgroup_limit(void)
+{
+    char cgroups[4096];
+    char path[PATH_MAX];
+    char value[64];
+    size_t limit = 0;
+
+    if (read_small_file("/proc/self/cgroup", cgroups, sizeof(cgroups)) > 0) {
+        // Case: the "0::<path>" line names our cgroup v2 group
+        for (char *line = cgroups; line != NULL && *line != '\0'; line = strchr(line, '\n')) {
+            line += *line == '\n';
+
+            if (strncmp(line, "0::/", 4) != 0) {
+                continue;
+            }
+
+            char *group = line + 3;
+            group[strcspn(group, "\n")] = '\0';
+
+            while (true) {
+                int length = snprintf(path, sizeof(path), "/sys/fs/cgroup%s/memory.max",
+                        strcmp(group, "/") == 0 ? "" : group);
+
+                if (length < (int) sizeof(path) && read_small_file(path, value, sizeof(value)) > 0
+                        && strncmp(value, "max", 3) != 0) {
+                    size_t group_limit = strtoull(value, NULL, 10);
+
+                    if (group_limit != 0 && (limit == 0 || group_limit < limit)) {
+                        limit = group_limit;
+                    }
+                }
+
+                char *slash = strrchr(group, '/');
+
+                if (slash == NULL || slash == group) {
+                    break;
+                }
+                *slash = '\0';
+            }
+            break;
+        }
+    }
+
+    if (limit == 0 && read_small_file("/sys/fs/cgroup/memory/memory.limit_in_bytes",
+                value, sizeof(value)) > 0) {
+        limit = strtoull(value, NULL, 10);
+    }
+
+    return limit < CGROUP_UNLIMITED ? limit : 0;
+}
+
+/**
+ * @brief      Reads ALLOCATOR_MEM_LIMIT (default: the cgroup's memory limit; 0 turns limits off)
+ *              and ALLOCATOR_SOFT_LIMIT (default: MEM_SOFT_PERCENT of the limit). Above the soft
+ *              watermark, free memory is given back to the kernel before the heap grows.
+ */
+void init_mem_limit(void)
+{
+    size_t limit;
+    size_t soft = 0;
+
+    if (!parse_size("ALLOCATOR_MEM_LIMIT", &limit)) {
+        limit = read_cgroup_limit();
+    }
+    parse_size("ALLOCATOR_SOFT_LIMIT", &soft);
+
+    if (soft == 0) {
+        soft = limit / 100 * MEM_SOFT_PERCENT;
+    }
+    else if (limit != 0 && soft > limit) {
+        soft = limit;
+    }
+
+    pthread_mutex_lock(&alloc_mutex);
+    g_stats.mem_limit = limit;
+    g_stats.soft_limit = soft;
+    pthread_mutex_unlock(&alloc_mutex);
+}
+
+/**
+ * @brief      Gets how much of the heap is (probably) resident: everything mapped, except free
+ *              runs that were purged. Called with alloc_mutex held.
+ *
+ * @return     heap usage in bytes
+ */
+size_t get_heap_usage(void)
+{
+    return g_stats.mapped_bytes - g_stats.purged_bytes;
+}
+
+/**
+ * @brief      Tells whether growing the heap by request bytes would take it past the soft
+ *              watermark. Called with alloc_mutex held.
+ *
+ * @param[in]  request  bytes about to be mapped (0 to ask about the heap as it is)
+ *
+ * @return     true if free memory should be given back
+ */
+bool under_pressure(size_t request)
+{
+    return g_stats.soft_limit != 0 && get_heap_usage() + request > g_stats.soft_limit;
+}
+
+/**
+ * @brief      Gets the whole pages inside a free block, past its header. Those can be handed back
+ *              to the kernel without touching the list.
+ *
+ * @param      block   free block
+ * @param      start   where to store the first page
+ * @param      length  where to store the length of the range
+ *
+ * @return     false if the block doesn't cover a whole page past its header
+ */
+bool get_purge_range(struct mem_block *block, char **start, size_t *length)
+{
+    uintptr_t page_size = getpagesize();
+    uintptr_t first = ((uintptr_t) (block + 1) + page_size - 1) & ~(page_size - 1);
+    uintptr_t last = ((uintptr_t) block + block->size) & ~(page_size - 1);
+
+    if (last <= first) {
+        return false;
+    }
+
+    *start = (char *) first;
+    *length = last - first;
+    return true;
+}
+
+/**
+ * @brief      Gives a free block's pages back to the kernel. The block stays in the list; its pages
+ *              fault back in, zeroed, when it's used again. MADV_DONTNEED rather than MADV_FREE, so
+ *              the pages leave the process's RSS (and the cgroup's usage) right away.
+ *
+ * @param      block  free block (does nothing if it's already purged or smaller than a page)
+ */
+void purge_block(struct mem_block *block)
+{
+    char *start;
+    size_t length;
+
+    if (block->purged || !get_purge_range(block, &start, &length)
+            || madvise(start, length, MADV_DONTNEED) == -1) {
+        return;
+    }
+
+    block->purged = true;
+    g_stats.purged_bytes += length;
+    g_stats.purges++;
+}
+
+/**
+ * @brief      Purges a free run right away if the heap is above the soft watermark and the run is at
+ *              least PURGE_MIN_RUN. Called with alloc_mutex held.
+ *
+ * @param      block  free block, already merged with its neighbors
+ */
+void purge_if_pressured(struct mem_block *block)
+{
+    if (block->size >= PURGE_MIN_RUN && under_pressure(0)) {
+        purge_block(block);
+    }
+}
+
+/**
+ * @brief      Counts a purged block's pages as resident again. Must be called before the block is
+ *              resized or handed out.
+ *
+ * @param      block  block (does nothing if it isn't purged)
+ */
+void unpurge_block(struct mem_block *block)
+{
+    char *start;
+    size_t length;
+
+    if (block->purged && get_purge_range(block, &start, &length)) {
+        g_stats.purged_bytes -= length;
+    }
+    block->purged = false;
+}
+
+/**
+ * @brief      Unmaps a heap region with nothing in use, taking it off the block and region lists
+ *
+ * @param      region  heap region
+ * @param      block   its only block, which spans the whole region
+ */
+void unmap_heap_region(struct mem_region *region, struct mem_block *block)
+{
+    unpurge_block(block);
+    unreserve_block(block);
+    ll_delete(block);
+
+    if (region->prev != NULL) {
+        region->prev->next = region->next;
+    }
+    else {
+        g_first_region = region->next;
+    }
+    if (region->next != NULL) {
+        region->next->prev = region->prev;
+    }
+    else {
+        g_last_region = region->prev;
+    }
+
+    g_free_bytes -= region->free_bytes;
+    g_stats.mapped_bytes -= region->size;
+
+    unregister_region(region);
+    munmap(region->base, region->size);
+    release_region(region);
+    g_stats.regions_unmapped++;
+}
+
+/**
+ * @brief      Gives free memory back to the kernel before the heap grows past the soft watermark.
+ *              Empty retained regions are unmapped, reserved slack is merged with its neighbors,
+ *              and free runs of at least PURGE_MIN_RUN are purged. If the heap would also go past
+ *              the limit, every free page is purged. Called with alloc_mutex held.
+ *
+ * @param[in]  request  bytes about to be mapped
+ *
+ * @return     true if a pass was made, false if too little was freed since the last one
+ */
+bool relieve_pressure(size_t request)
+{
+    bool over_limit = g_stats.mem_limit != 0 && get_heap_usage() + request > g_stats.mem_limit;
+    size_t min_run = over_limit ? (size_t) getpagesize() : PURGE_MIN_RUN;
+    size_t idle = g_free_bytes - g_stats.purged_bytes;
+
+    if (idle < g_purge_floor) {
+        g_purge_floor = idle;
+    }
+
+    // Case: not enough has been freed since the last pass to be worth walking the heap again
+    if (idle < g_purge_floor + min_run) {
+        return false;
+    }
+
+    g_stats.pressure_events++;
+    drain_depots();
+
+    struct mem_region *region = g_first_region;
+
+    while (region != NULL) {
+        struct mem_region *next_region = region->next;
+        struct mem_block *block = get_first_block(region);
+
+        // Case: retained region with nothing in use (e.g. the ALLOCATOR_RESERVE region)
+        if (region->live == 0) {
+            unmap_heap_region(region, block);
+            region = next_region;
+            continue;
+        }
+
+        for (; block != NULL && block->region_id == region->id; block = block->next) {
+            if (!block->free) {
+                continue;
+            }
+
+            block = merge_block(block);
+
+            if (block->size >= min_run) {
+                purge_block(block);
+            }
+        }
+
+        region = next_region;
+    }
+
+    g_purge_floor = g_free_bytes - g_stats.purged_bytes;
+    return true;
+}
+
+/* Copying extremely helpful diagram from class:
+ * 
+ * aloocate(50) with header:
+ * 
+ * [HHHHHHHHHH][XXXXX]
+ * |            |
+ * |            |
+ * |            user wants this pointer - malloc returns ptr to here
+ * |
+ * mmap returns ptr here
+ * 
+ */
+
+/**
+ * @brief      Does the following things to a block of data:
+ *              1. If it's NULL, does nothing
+ *              2. Otherwise, sets ->free to true
+ *                  2.1. Always attempts to merge neighboring free blocks together
+ *                  2.2. If also the only block left in its region, unmaps it
+ *
+ * @param      ptr   ptr to block of data
+ *
+ * @note       Does the work for free(). Leaves the code path taken in t_outcome.
+ */
+void free_internal(void *ptr)
+{
+    free_pointer(ptr, false, 0);
+}
+
+/**
+ * @brief      Frees ptr; see free_internal(). When sized, size is what the caller says it asked
+ *              for (free_sized(), sized delete). With magazines on, it picks the magazine class,
+ *              and a size too big for any magazine skips the magazine layer. Either way the hint
+ *              is checked against the block's header: a block it doesn't fit isn't cached, and the
+ *              locked pass that frees it reports the mismatch and frees the block anyway.
+ *
+ * @param      ptr    pointer to free (may be NULL)
+ * @param[in]  sized  whether size is known
+ * @param[in]  size   size passed to the allocation call, if sized
+ */
+void free_pointer(void *ptr, bool sized, size_t size)
+{
+    t_outcome = OUTCOME_LIST;
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    struct mem_region *region = pagemap_lookup(ptr);
+
+    // Case: sampled allocation - the guard pool is never unmapped, so no need for alloc_mutex
+    if (region != NULL && region->kind == REGION_GUARD) {
+        t_outcome = OUTCOME_GUARDED;
+        guarded_free(ptr);
+        return;
+    }
+
+    // Case: small block - cache it in the thread's magazines, also without alloc_mutex
+    if (region != NULL && (!sized || size <= MAGAZINE_MAX_SIZE)
+            && magazine_free(region, get_header_from_data(ptr),
+                sized ? get_aligned_size(size + sizeof(struct mem_block)) : 0)) {
+        t_outcome = OUTCOME_MAGAZINE;
+        return;
+    }
+
+    pthread_mutex_lock(&alloc_mutex);
+    region = pagemap_lookup(ptr);
+
+    // Case: not our memory (e.g. libc's memalign()) - hand it back to libc
+    if (region == NULL) {
+        pthread_mutex_unlock(&alloc_mutex);
+        t_outcome = OUTCOME_FOREIGN;
+        libc_free(ptr);
+        return;
+    }
+
+    struct mem_block *block = get_header_from_data(ptr);
+
+    // Case: inside one of our regions, but not the start of a live allocation - leave the heap alone
+    if (!block_is_valid(region, block)) {
+        pthread_mutex_unlock(&alloc_mutex);
+        report_error("free(): invalid pointer %p\n", ptr);
+        return;
+    }
+
+    size_t usable = (char *) block + block->size - (char *) ptr;
+
+    g_stats.frees++;
+
+    if (release_block(region, block)) {
+        t_outcome = OUTCOME_UNMAP;
+    }
+
+    pthread_mutex_unlock(&alloc_mutex);
+
+    if (sized && size > usable) {
+        report_error("free_sized(): %p was freed with size %zu, but only holds %zu bytes\n",
+                ptr, size, usable);
+    }
+}
+
+/**
+ * @brief      Gives a used block back to the heap: marks it free, merges it with its neighbors, and
+ *              unmaps or purges what it ends up in. Called with alloc_mutex held.
+ *
+ * @param      region  region the block is in
+ * @param      block   used block
+ *
+ * @return     true if the region was unmapped
+ */
+bool release_block(struct mem_region *region, struct mem_block *block)
+{
+    block->free = true;
+    region->live--;
+
+    size_t freed = block->size;
+    block = merge_block(block); // Attempt to merge block
+    region_freed_run(region, freed);
+
+    // Case: nothing left in use, so (with neighbors merged) block spans the whole region. Retained
+    // regions are kept unless memory is short.
+    if (region->live == 0 && (!region->retained || under_pressure(0))) { // This should also handle g_head or g_tail change
+        unmap_heap_region(region, block);
+        return true;
+    }
+
+    // Case: region still in use - above the soft watermark, its free pages go back anyway
+    purge_if_pressured(block);
+    return false;
+}
+
+/**
+ * @brief      Reads ALLOCATOR_MAGAZINES. With ALLOCATOR_MAGAZINES=1, freed blocks up to
+ *              MAGAZINE_MAX_SIZE are cached per thread in magazines (Bonwick's magazine layer):
+ *              batches of MAGAZINE_ROUNDS blocks of one size class. Each thread keeps a loaded and a
+ *              previous magazine per class, and trades whole magazines with a per-class depot, so
+ *              blocks freed by one thread reach another in bulk. Cached blocks stay in use as far as
+ *              the heap is concerned.
+ */
+void init_magazines(void)
+{
+    char *setting = getenv("ALLOCATOR_MAGAZINES");
+
+    if (setting == NULL || strcmp(setting, "1") != 0) {
+        return;
+    }
+
+    for (int size_class = 0; size_class < MAGAZINE_CLASSES; size_class++) {
+        pthread_mutex_init(&g_depots[size_class].lock, NULL);
+    }
+
+    if (pthread_key_create(&g_magazine_key, release_thread_magazines) != 0) {
+        return;
+    }
+
+    g_magazines_enabled = true;
+}
+
+/**
+ * @brief      Gets the calling thread's magazines, adopting a set left behind by an exited thread
+ *              or mapping a new one
+ *
+ * @return     the thread's magazines, or NULL if none could be mapped
+ */
+struct magazine_cache *get_thread_magazines(void)
+{
+    if (t_magazines != NULL) {
+        return t_magazines;
+    }
+
+    struct magazine_cache *cache = __atomic_load_n(&g_magazine_caches, __ATOMIC_ACQUIRE);
+
+    for (; cache != NULL; cache = cache->next) {
+        bool expected = false;
+
+        if (__atomic_compare_exchange_n(&cache->in_use, &expected, true, false,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (cache == NULL) {
+        cache = mmap(NULL, sizeof(struct magazine_cache), PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (cache == MAP_FAILED) {
+            return NULL;
+        }
+
+        cache->in_use = true;
+        cache->next = __atomic_load_n(&g_magazine_caches, __ATOMIC_RELAXED);
+
+        while (!__atomic_compare_exchange_n(&g_magazine_caches, &cache->next, cache, false,
+                    __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            // cache->next was refreshed by the failed exchange; try again
+        }
+    }
+
+    // Set before pthread_setspecific(), which may allocate (and so come back here)
+    t_magazines = cache;
+    pthread_setspecific(g_magazine_key, cache);
+
+    return cache;
+}
+
+/**
+ * @brief      pthread key destructor: hands an exiting thread's magazines to the depot and frees
+ *              its set for the next thread. Its counters are kept.
+ *
+ * @param      cache  the thread's magazines
+ */
+void release_thread_magazines(void *cache)
+{
+    struct magazine_cache *magazines = cache;
+
+    for (int size_class = 0; size_class < MAGAZINE_CLASSES; size_class++) {
+        deposit_magazine(size_class, magazines->loaded[size_class]);
+        deposit_magazine(size_class, magazines->previous[size_class]);
+        magazines->loaded[size_class] = NULL;
+        magazines->previous[size_class] = NULL;
+    }
+
+    __atomic_store_n(&magazines->in_use, false, __ATOMIC_RELEASE);
+    t_magazines = NULL;
+}
+
+/**
+ * @brief      Takes a cached block of real_size's class from the calling thread's magazines. When
+ *              the loaded magazine is empty it's swapped with the previous one if that's full, or
+ *              else with a full magazine from the depot.
+ *
+ * @param[in]  real_size  size needed (includes header)
+ *
+ * @return     used block of at least real_size, or NULL if there's none cached (or magazines are off)
+ */
+struct mem_block *magazine_alloc(size_t real_size)
+{
+    size_t size_class = real_size / BLOCK_ALIGN;
+
+    if (!g_magazines_enabled || size_class >= MAGAZINE_CLASSES) {
+        return NULL;
+    }
+
+    struct magazine_cache *cache = get_thread_magazines();
+
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    struct magazine *loaded = cache->loaded[size_class];
+    struct magazine *previous = cache->previous[size_class];
+
+    if (loaded == NULL || loaded->rounds == 0) {
+        // Case: previous is full - the two trade places
+        if (previous != NULL && previous->rounds > 0) {
+            cache->previous[size_class] = loaded;
+            cache->loaded[size_class] = loaded = previous;
+        }
+        // Case: both empty - previous goes to the depot for a full one, and loaded becomes previous
+        else {
+            struct magazine *full = swap_empty_magazine(size_class, previous);
+
+            if (full == NULL) {
+                return NULL;
+            }
+
+            cache->previous[size_class] = loaded;
+            cache->loaded[size_class] = loaded = full;
+        }
+    }
+
+    struct mem_block *block = loaded->blocks[--loaded->rounds];
+
+    block->magic = BLOCK_MAGIC;
+    block->reallocs = 0;
+    cache->allocations++;
+
+    return block;
+}
+
+/**
+ * @brief      Caches a block being freed in the calling thread's magazines instead of returning it
+ *              to the heap. When the loaded magazine is full it's swapped with the previous one if
+ *              that's empty, or else with an empty magazine from the depot. Called without
+ *              alloc_mutex: block's header belongs to the caller until the block is freed, so it can
+ *              be read and written here. Only the heap's bookkeeping of its neighbors can change
+ *              under us, and none of that is touched.
+ *
+ * @param      region     heap region pointer came from
+ * @param      block      header computed from the pointer being freed
+ * @param[in]  real_size  size (includes header) the caller's size hint asks for, or 0 to use the
+ *                        block's own size. It must not be bigger than the block.
+ *
+ * @return     true if the block was cached, false if it has to go through the heap (magazines
+ *              off, block too big, bad size hint, or not a live allocation - free_pointer()
+ *              reports those)
+ */
+bool magazine_free(struct mem_region *region, struct mem_block *block, size_t real_size)
+{
+    if (!g_magazines_enabled || !block_is_valid(region, block) || real_size > block->size) {
+        return false;
+    }
+
+    size_t size_class = (real_size != 0 ? real_size : block->size) / BLOCK_ALIGN;
+
+    if (size_class >= MAGAZINE_CLASSES) {
+        return false;
+    }
+
+    struct magazine_cache *cache = get_thread_magazines();
+
+    if (cache == NULL) {
+        return false;
+    }
+
+    struct magazine *loaded = cache->loaded[size_class];
+    struct magazine *previous = cache->previous[size_class];
+
+    if (loaded == NULL || loaded->rounds == MAGAZINE_ROUNDS) {
+        // Case: previous is empty - the two trade places
+        if (previous != NULL && previous->rounds == 0) {
+            cache->previous[size_class] = loaded;
+            cache->loaded[size_class] = loaded = previous;
+        }
+        // Case: both full - previous goes to the depot for an empty one, and loaded becomes previous
+        else {
+            struct magazine *empty = swap_full_magazine(size_class, previous);
+
+            if (empty == NULL) {
+                return false;
+            }
+
+            cache->previous[size_class] = loaded;
+            cache->loaded[size_class] = loaded = empty;
+        }
+    }
+
+    block->magic = MAGAZINE_MAGIC;
+    loaded->blocks[loaded->rounds++] = block;
+    cache->frees++;
+
+    return true;
+}
+
+/**
+ * @brief      Trades an empty magazine for a full one from the depot
+ *
+ * @param[in]  size_class  size class
+ * @param      empty       empty magazine to leave in the depot (may be NULL)
+ *
+ * @return     full magazine, or NULL if the depot has none (empty is then kept by the caller)
+ */
+struct magazine *swap_empty_magazine(size_t size_class, struct magazine *empty)
+{
+    struct magazine_depot *depot = &g_depots[size_class];
+
+    // Case: nothing to take - don't bother with the lock
+    if (__atomic_load_n(&depot->full_count, __ATOMIC_RELAXED) == 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&depot->lock);
+
+    struct magazine *full = depot->full;
+
+    if (full != NULL) {
+        depot->full = full->next;
+        __atomic_store_n(&depot->full_count, depot->full_count - 1, __ATOMIC_RELAXED);
+        depot->exchanges++;
+
+        if (empty != NULL) {
+            empty->next = depot->empty;
+            depot->empty = empty;
+        }
+    }
+
+    pthread_mutex_unlock(&depot->lock);
+    return full;
+}
+
+/**
+ * @brief      Trades a full magazine for an empty one from the depot. If the depot already holds
+ *              MAGAZINE_DEPOT_MAX full magazines, the blocks go back to the heap instead, in one
+ *              pass under alloc_mutex, and the same magazine comes back empty.
+ *
+ * @param[in]  size_class  size class
+ * @param      full        full magazine to leave in the depot (may be NULL)
+ *
+ * @return     empty magazine, or NULL if none could be mapped (full is then kept by the caller)
+ */
+struct magazine *swap_full_magazine(size_t size_class, struct magazine *full)
+{
+    struct magazine_depot *depot = &g_depots[size_class];
+
+    pthread_mutex_lock(&depot->lock);
+
+    if (full != NULL && depot->full_count >= MAGAZINE_DEPOT_MAX) {
+        pthread_mutex_unlock(&depot->lock);
+
+        pthread_mutex_lock(&alloc_mutex);
+        flush_magazine(full);
+        pthread_mutex_unlock(&alloc_mutex);
+
+        return full;
+    }
+
+    struct magazine *empty = pop_empty_magazine(size_class);
+
+    if (empty != NULL && full != NULL) {
+        full->next = depot->full;
+        depot->full = full;
+        __atomic_store_n(&depot->full_count, depot->full_count + 1, __ATOMIC_RELAXED);
+    }
+    if (empty != NULL) {
+        depot->exchanges++;
+    }
+
+    pthread_mutex_unlock(&depot->lock);
+    return empty;
+}
+
+/**
+ * @brief      Takes an empty magazine from a depot, mapping a page of new ones if it has none.
+ *              Called with the depot's lock held.
+ *
+ * @param[in]  size_class  size class
+ *
+ * @return     empty magazine, or NULL if no memory is available
+ */
+struct magazine *pop_empty_magazine(size_t size_class)
+{
+    struct magazine_depot *depot = &g_depots[size_class];
+
+    if (depot->empty == NULL) {
+        size_t page_size = getpagesize();
+        struct magazine *batch = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (batch == MAP_FAILED) {
+            return NULL;
+        }
+
+        for (size_t i = 0; i < page_size / sizeof(struct magazine); i++) {
+            batch[i].next = depot->empty;
+            depot->empty = &batch[i];
+        }
+    }
+
+    struct magazine *magazine = depot->empty;
+    depot->empty = magazine->next;
+    magazine->rounds = 0;
+
+    return magazine;
+}
+
+/**
+ * @brief      Returns every block in a magazine to the heap. Called with alloc_mutex held.
+ *
+ * @param      magazine  magazine; empty afterwards
+ */
+void flush_magazine(struct magazine *magazine)
+{
+    while (magazine->rounds > 0) {
+        struct mem_block *block = magazine->blocks[--magazine->rounds];
+
+        block->magic = BLOCK_MAGIC;
+        release_block(pagemap_lookup(block), block);
+    }
+
+    g_stats.magazine_flushes++;
+}
+
+/**
+ * @brief      Leaves a magazine in the depot: on the full list if it holds anything, else on the
+ *              empty list. If the depot already has enough full magazines, the blocks go back to
+ *              the heap first.
+ *
+ * @param[in]  size_class  size class
+ * @param      magazine    magazine (may be NULL)
+ */
+void deposit_magazine(size_t size_class, struct magazine *magazine)
+{
+    struct magazine_depot *depot = &g_depots[size_class];
+
+    if (magazine == NULL) {
+        return;
+    }
+
+    if (magazine->rounds > 0
+            && __atomic_load_n(&depot->full_count, __ATOMIC_RELAXED) >= MAGAZINE_DEPOT_MAX) {
+        pthread_mutex_lock(&alloc_mutex);
+        flush_magazine(magazine);
+        pthread_mutex_unlock(&alloc_mutex);
+    }
+
+    pthread_mutex_lock(&depot->lock);
+
+    if (magazine->rounds > 0) {
+        magazine->next = depot->full;
+        depot->full = magazine;
+        __atomic_store_n(&depot->full_count, depot->full_count + 1, __ATOMIC_RELAXED);
+    }
+    else {
+        magazine->next = depot->empty;
+        depot->empty = magazine;
+    }
+
+    pthread_mutex_unlock(&depot->lock);
+}
+
+/**
+ * @brief      Returns the blocks in every full magazine in the depot to the heap, so they can merge
+ *              and be purged. Magazines loaded by threads are left alone. Called with alloc_mutex
+ *              held.
+ */
+void drain_depots(void)
+{
+    if (!g_magazines_enabled) {
+        return;
+    }
+
+    for (int size_class = 0; size_class < MAGAZINE_CLASSES; size_class++) {
+        struct magazine_depot *depot = &g_depots[size_class];
+
+        pthread_mutex_lock(&depot->lock);
+        struct magazine *full = depot->full;
+        depot->full = NULL;
+        __atomic_store_n(&depot->full_count, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&depot->lock);
+
+        while (full != NULL) {
+            struct magazine *next = full->next;
+
+            flush_magazine(full);
+            deposit_magazine(size_class, full);
+            full = next;
+        }
+    }
+}
+
+/**
+ * @brief      Adds the magazine counters, which threads keep for themselves, to a copy of g_stats
+ *
+ * @param      stats  copy of g_stats
+ */
+void add_magazine_stats(struct allocator_stats *stats)
+{
+    struct magazine_cache *cache = __atomic_load_n(&g_magazine_caches, __ATOMIC_ACQUIRE);
+
+    for (; cache != NULL; cache = cache->next) {
+        stats->magazine_allocations += cache->allocations;
+        stats->magazine_frees += cache->frees;
+    }
+
+    for (int size_class = 0; size_class < MAGAZINE_CLASSES && g_magazines_enabled; size_class++) {
+        stats->depot_exchanges += g_depots[size_class].exchanges;
+    }
+
+    stats->allocations += stats->magazine_allocations;
+    stats->frees += stats->magazine_frees;
+}
+
+
+/**
+ * @brief      Mallocs, then writes 0's over all of data block
+ * @param[in]  nmemb  number of type members being allocated (e.g. array.length() if allocating an array)
+ * @param[in]  size   size of each member
+ *
+ * @return     pointer to block of data, or NULL if nmemb * size overflows
+ *
+ * @note       Does the work for calloc(). Leaves the code path taken in t_outcome.
+ */
+void *calloc_internal(size_t nmemb, size_t size)
+{
+    // Case: nmemb * size doesn't fit in a size_t
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        t_outcome = OUTCOME_LIST;
+        return NULL;
+    }
+
+    void* block = malloc_internal(nmemb * size);
+
+    if (block != NULL) {
+        memset(block, 0, nmemb * size);
+    }
+
+    return block;
+}
+
+/**
+ * @brief      Does the following to a pointer to a data block, given a size:
+ *              1. If ptr is NULL, runs malloc(size)
+ *              2. If size == 0, runs free(ptr)
+ *              3. Else:
+ *                  3.1. If data block can expand into the next neighboring one (next neighbor must be free), does so
+ *                  3.2. IF it can't, mallocs a new block, copies data from old block to new block, and frees old block
+ *
+ * @param      ptr   pointer to data block
+ * @param[in]  size  requested size
+ *
+ * @return     pointer to processed
+ *
+ * @note       Does the work for realloc(). Leaves the code path taken in t_outcome.
+ */
+void *realloc_internal(void *ptr, size_t size)
+{
+    LOGP("REALLOC CALLED\n");
+    // Case: ptr is NULL - do malloc(size)
+    if (ptr == NULL) {
+        return malloc_internal(size);
+    }
+    // Case: size == 0 - do free(ptr) 
+    else if (size == 0) {
+        free_internal(ptr);
+        return NULL;
+    }
+
+    // Case: ptr != NULL, size != 0, reallocate data
+    struct mem_region *region = pagemap_lookup(ptr);
+
+    // Case: sampled allocation - always move it, so the new size gets its own guard placement
+    if (region != NULL && region->kind == REGION_GUARD) {
+        size_t old_size = guarded_size(ptr);
+        void *new_data = malloc_internal(size);
+
+        if (new_data != NULL) {
+            memcpy(new_data, ptr, old_size < size ? old_size : size);
+            free_internal(ptr);
+        }
+        t_outcome = OUTCOME_MOVED;
+        return new_data;
+    }
+
+    pthread_mutex_lock(&alloc_mutex);
+    region = pagemap_lookup(ptr);
+
+    // Case: not our memory - let libc resize it
+    if (region == NULL) {
+        pthread_mutex_unlock(&alloc_mutex);
+        t_outcome = OUTCOME_FOREIGN;
+        return libc_realloc(ptr, size);
+    }
+
+    struct mem_block* head = get_header_from_data(ptr);
+
+    if (!block_is_valid(region, head)) {
+        pthread_mutex_unlock(&alloc_mutex);
+        report_error("realloc(): invalid pointer %p\n", ptr);
+        t_outcome = OUTCOME_LIST;
+        return NULL;
+    }
+
+    if (size > SIZE_MAX - sizeof(struct mem_block) - REALLOC_SLACK_MAX - BLOCK_ALIGN) {
+        pthread_mutex_unlock(&alloc_mutex);
+        t_outcome = OUTCOME_LIST;
+        return NULL;
+    }
+
+    struct mem_block* next = head->next;
+    size_t old_size = head->size - sizeof(struct mem_block);
+    size_t real_size = get_aligned_size(size + sizeof(struct mem_block));
+
+    if (head->reallocs < USHRT_MAX) {
+        head->reallocs++;
+    }
+
+    // Case: shrinking, or growing into the block after it (often slack reserved by an earlier
+    // realloc()) - resize in place
+    if (real_size <= head->size) {
+        trim_block(head, real_size);
+        g_stats.reallocs_in_place++;
+        pthread_mutex_unlock(&alloc_mutex);
+        t_outcome = OUTCOME_IN_PLACE;
+        return get_data_from_header(head);
+    }
+    if (try_to_expand_block_into(head, next, real_size) == 1) {
+        reserve_slack(head, real_size);
+        g_stats.reallocs_in_place++;
+        pthread_mutex_unlock(&alloc_mutex);
+        t_outcome = OUTCOME_IN_PLACE;
+        return get_data_from_header(head);
+    }
+
+    unsigned short reallocs = head->reallocs;
+    pthread_mutex_unlock(&alloc_mutex);
+
+    // Case: can't expand - copy over data from old block to new location, free old block, return
+    // new location. A block that keeps growing gets room for its slack up front.
+    size_t slack = reallocs >= REALLOC_SLACK_AFTER ? get_slack_size(real_size) : 0;
+    void* new_data = malloc_internal(size + slack);
+
+    if (new_data != NULL) {
+        struct mem_region *new_region = pagemap_lookup(new_data);
+
+        if (new_region->kind == REGION_HEAP) {
+            pthread_mutex_lock(&alloc_mutex);
+            struct mem_block *new_head = get_header_from_data(new_data);
+            new_head->reallocs = reallocs;
+            reserve_slack(new_head, real_size);
+            pthread_mutex_unlock(&alloc_mutex);
+        }
+
+        memcpy(new_data, ptr, old_size < size ? old_size : size);
+        free_internal(ptr);
+    }
+
+    t_outcome = OUTCOME_MOVED;
+    return new_data;
+}
+
+/**
+ * @brief      Allocates size bytes whose address is a multiple of alignment. Small alignments are
+ *              already guaranteed by malloc_internal(). For larger ones we over-allocate, then
+ *              carve a new block whose data starts on the boundary: the leading piece goes back to
+ *              the free list, and so does any trailing piece that's big enough to be a block.
+ *
+ * @param[in]  alignment  power of two
+ * @param[in]  size       requested size
+ *
+ * @return     aligned data block, or NULL if alignment is invalid or memory ran out
+ */
+void *aligned_alloc_internal(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+
+    if (alignment <= BLOCK_ALIGN) {
+        return malloc_internal(size);
+    }
+
+    size_t min_sz = sizeof(struct mem_block) + BLOCK_ALIGN;
+
+    if (size > SIZE_MAX - alignment - min_sz) {
+        return NULL;
+    }
+
+    // Guard slots only align to GUARD_ALIGN, so a sample that falls due here is pushed back to
+    // the thread's next allocation
+    if (t_sample_countdown <= 1) {
+        t_sample_countdown = 2;
+    }
+
+    void *data = malloc_internal(size + alignment + min_sz);
+
+    if (data == NULL || (uintptr_t) data % alignment == 0) {
+        return data;
+    }
+
+    pthread_mutex_lock(&alloc_mutex);
+
+    // Leave at least min_sz in front so the leading piece can stand as a free block of its own
+    struct mem_block *block = get_header_from_data(data);
+    char *aligned_data = (char *) (((uintptr_t) data + min_sz + alignment - 1) & ~(alignment - 1));
+    struct mem_block *aligned_block = get_header_from_data(aligned_data);
+    size_t lead = (char *) aligned_block - (char *) block;
+
+    aligned_block->magic = BLOCK_MAGIC;
+    aligned_block->size = block->size - lead;
+    aligned_block->region_id = block->region_id;
+    aligned_block->next = NULL;
+    aligned_block->prev = NULL;
+    aligned_block->reserved = false;
+    aligned_block->purged = false;
+    aligned_block->reallocs = 0;
+    block->size = lead;
+
+    ll_add(block, aligned_block);
+    if (block == g_tail) {
+        g_tail = aligned_block;
+        g_tail->next = NULL;
+    }
+    strcpy(aligned_block->name, block->name);
+
+    // Trim the tail the same way reuse() would
+    trim_block(aligned_block, get_aligned_size(size + sizeof(struct mem_block)));
+
+    block->free = true;
+    region_freed_run(pagemap_lookup(block), lead);
+    merge_block(block);
+
+    pthread_mutex_unlock(&alloc_mutex);
+
+    return aligned_data;
+}
+
+/**
+ * @brief      Frees ptr, given the size it was allocated with (C23 free_sized(), C++14 sized
+ *              delete). See free_pointer().
+ *
+ * @param      ptr   pointer to free (may be NULL)
+ * @param[in]  size  size passed to the allocation call
+ */
+void free_sized_internal(void *ptr, size_t size)
+{
+    free_pointer(ptr, true, size);
+}
+
+/**
+ * @brief      Gets how many bytes can be used at ptr
+ *
+ * @param      ptr   pointer returned by one of our allocation functions
+ *
+ * @return     usable size, or 0 if ptr is NULL or isn't a live allocation of ours
+ */
+size_t usable_size_internal(void *ptr)
+{
+    if (ptr == NULL) {
+        return 0;
+    }
+
+    struct mem_region *region = pagemap_lookup(ptr);
+
+    if (region != NULL && region->kind == REGION_GUARD) {
+        return guarded_size(ptr);
+    }
+
+    pthread_mutex_lock(&alloc_mutex);
+
+    region = pagemap_lookup(ptr);
+    struct mem_block *block = get_header_from_data(ptr);
+    size_t usable = 0;
+
+    if (region != NULL && block_is_valid(region, block)) {
+        usable = (char *) block + block->size - (char *) ptr;
+    }
+
+    pthread_mutex_unlock(&alloc_mutex);
+    return usable;
+}
+
+/**
+ * @brief      Reads the cheapest monotonic counter the platform has: the TSC on x86, the virtual
+ *              counter on AArch64, and clock_gettime() everywhere else
+ *
+ * @return     current counter value, in LATENCY_UNIT
+ */
+static inline uint64_t read_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t value;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+/**
+ * @brief      pthread key destructor: gives an exiting thread's histograms back so another thread
+ *              can keep adding to them
+ *
+ * @param      histograms  the exiting thread's histograms
+ */
+void release_thread_latency(void *histograms)
+{
+    __atomic_store_n(&((struct latency_histograms *) histograms)->in_use, false, __ATOMIC_RELEASE);
+    t_latency = NULL;
+}
+
+/**
+ * @brief      Gets the calling thread's histograms, adopting a set left behind by an exited thread
+ *              or mapping a new one
+ *
+ * @return     the thread's histograms, or NULL if none could be mapped
+ */
+struct latency_histograms *get_thread_latency(void)
+{
+    if (t_latency != NULL) {
+        return t_latency;
+    }
+
+    struct latency_histograms *histograms = __atomic_load_n(&g_latency_threads, __ATOMIC_ACQUIRE);
+
+    for (; histograms != NULL; histograms = histograms->next) {
+        bool expected = false;
+
+        if (__atomic_compare_exchange_n(&histograms->in_use, &expected, true, false,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (histograms == NULL) {
+        histograms = mmap(NULL, sizeof(struct latency_histograms), PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (histograms == MAP_FAILED) {
+            return NULL;
+        }
+
+        histograms->in_use = true;
+        histograms->next = __atomic_load_n(&g_latency_threads, __ATOMIC_RELAXED);
+
+        while (!__atomic_compare_exchange_n(&g_latency_threads, &histograms->next, histograms, false,
+                    __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            // histograms->next was refreshed by the failed exchange; try again
+        }
+    }
+
+    // Set before pthread_setspecific(), which may allocate (and so come back here)
+    t_latency = histograms;
+    pthread_setspecific(g_latency_key, histograms);
+
+    return histograms;
+}
+
+/**
+ * @brief      Adds one timed call to the calling thread's histograms, filed under the outcome the
+ *              call left in t_outcome
+ *
+ * @param[in]  op     LATENCY_MALLOC, LATENCY_FREE, LATENCY_REALLOC or LATENCY_CALLOC
+ * @param[in]  start  read_cycles() value taken when the call started
+ */
+void record_latency(int op, uint64_t start)
+{
+    if (!g_latency_enabled) {
+        return;
+    }
+
+    uint64_t elapsed = read_cycles() - start;
+    struct latency_histograms *histograms = get_thread_latency();
+
+    if (histograms != NULL) {
+        histograms->counts[op][t_outcome][get_size_bucket(elapsed | 1)]++;
+    }
+}
+
+/**
+ * @brief      Reads ALLOCATOR_LATENCY. Calls are only timed once this has run.
+ */
+void init_latency(void)
+{
+    char *setting = getenv("ALLOCATOR_LATENCY");
+
+    if (setting != NULL && strcmp(setting, "1") == 0
+            && pthread_key_create(&g_latency_key, release_thread_latency) == 0) {
+        g_latency_enabled = true;
+    }
+}
+
+/**
+ * @brief      Gets CLOCK_MONOTONIC in nanoseconds
+ *
+ * @return     current time, in ns
+ */
+static uint64_t get_monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * @brief      If ALLOCATOR_TRACE is set, opens the file it names and starts recording every
+ *              allocation and free into it (see struct trace_record). A "%p" in the name is
+ *              replaced by the process ID, so child processes that also load the allocator don't
+ *              overwrite their parent's trace.
+ *
+ *              Frees are recorded before they take effect and allocations after, so a pointer
+ *              that's freed and handed out again is always recorded in that order. realloc() does
+ *              both at once, so it holds trace_mutex across the call.
+ */
+void init_trace(void)
+{
+    char *setting = getenv("ALLOCATOR_TRACE");
+
+    if (setting == NULL || setting[0] == '\0') {
+        return;
+    }
+
+    char path[PATH_MAX];
+    size_t length = 0;
+
+    for (const char *c = setting; *c != '\0' && length < sizeof(path) - 1; c++) {
+        if (c[0] == '%' && c[1] == 'p') {
+            length += snprintf(path + length, sizeof(path) - length, "%d", getpid());
+            c++;
+        }
+        else {
+            path[length++] = *c;
+        }
+    }
+    path[length < sizeof(path) ? length : sizeof(path) - 1] = '\0';
+
+    g_trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (g_trace_fd < 0) {
+        report_error("ALLOCATOR_TRACE: could not open %s\n", path);
+        return;
+    }
+
+    g_trace_buffer = mmap(NULL, TRACE_BUFFER_RECORDS * sizeof(struct trace_record),
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (g_trace_buffer == MAP_FAILED) {
+        close(g_trace_fd);
+        return;
+    }
+
+    struct trace_header header = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .record_size = sizeof(struct trace_record),
+        .pid = getpid(),
+    };
+
+    if (write(g_trace_fd, &header, sizeof(header)) != sizeof(header)) {
+        close(g_trace_fd);
+        return;
+    }
+
+    g_trace_start = get_monotonic_ns();
+    pthread_atfork(NULL, NULL, disable_trace_in_child);
+    g_trace_enabled = true;
+}
+
+/**
+ * @brief      fork() handler: the child shares the parent's trace file and buffer, so it stops
+ *              recording (an exec'd child can start its own trace with "%p")
+ */
+void disable_trace_in_child(void)
+{
+    g_trace_enabled = false;
+    pthread_mutex_init(&trace_mutex, NULL);
+}
+
+/**
+ * @brief      Takes trace_mutex for a record, unless tracing is off or the calling thread already
+ *              holds it (an allocation made from inside the recorder, or from a realloc() being
+ *              traced). Pass the result to trace_end().
+ *
+ * @return     true if trace_mutex was taken
+ */
+bool trace_begin(void)
+{
+    if (!g_trace_enabled || t_tracing) {
+        return false;
+    }
+
+    t_tracing = true;
+    pthread_mutex_lock(&trace_mutex);
+    return true;
+}
+
+/**
+ * @brief      Writes a record and releases trace_mutex, if trace_begin() took it
+ *
+ * @param[in]  traced  what trace_begin() returned
+ * @param[in]  op      enum trace_op
+ * @param      ptr     pointer returned, or pointer freed
+ * @param[in]  arg     see trace_record.arg
+ * @param[in]  size    requested size
+ */
+void trace_end(bool traced, int op, void *ptr, uint64_t arg, size_t size)
+{
+    if (!traced) {
+        return;
+    }
+
+    // Tracing may have stopped while we waited (allocator_fini() or a failed write), and free(NULL)
+    // does nothing, so it's not worth a record
+    if (g_trace_enabled && (op != TRACE_FREE || ptr != NULL)) {
+        if (t_trace_tid == 0) {
+            t_trace_tid = gettid();
+        }
+
+        struct trace_record *record = &g_trace_buffer[g_trace_count++];
+
+        record->timestamp = get_monotonic_ns() - g_trace_start;
+        record->ptr = (uintptr_t) ptr;
+        record->arg = arg;
+        record->size = size;
+        record->tid = t_trace_tid;
+        record->op = op;
+
+        if (g_trace_count == TRACE_BUFFER_RECORDS) {
+            flush_trace();
+        }
+    }
+
+    pthread_mutex_unlock(&trace_mutex);
+    t_tracing = false;
+}
+
+/**
+ * @brief      Records a call that has already happened (an allocation) or hasn't started yet (a
+ *              free)
+ *
+ * @param[in]  op    enum trace_op
+ * @param      ptr   pointer returned, or pointer freed
+ * @param[in]  arg   see trace_record.arg
+ * @param[in]  size  requested size
+ */
+void trace_record(int op, void *ptr, uint64_t arg, size_t size)
+{
+    trace_end(trace_begin(), op, ptr, arg, size);
+}
+
+/**
+ * @brief      Writes the buffered trace records out. Called with trace_mutex held.
+ */
+void flush_trace(void)
+{
+    char *data = (char *) g_trace_buffer;
+    size_t remaining = g_trace_count * sizeof(struct trace_record);
+
+    while (remaining > 0) {
+        ssize_t written = write(g_trace_fd, data, remaining);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            report_error("ALLOCATOR_TRACE: write failed, tracing stopped\n");
+            g_trace_enabled = false;
+            break;
+        }
+
+        data += written;
+        remaining -= written;
+    }
+
+    g_trace_count = 0;
+}
+
+/**
+ * @brief      Allocates memory. See malloc_internal(); with ALLOCATOR_LATENCY=1 the call is also
+ *              timed, and with ALLOCATOR_TRACE set it is recorded.
+ *
+ * @param[in]  size  size (not including header)
+ *
+ * @return     A block of data with its size = size
+ */
+void *malloc(size_t size)
+{
+    if (!g_latency_enabled && !g_trace_enabled) {
+        return malloc_internal(size);
+    }
+
+    uint64_t start = read_cycles();
+    void *ptr = malloc_internal(size);
+    trace_record(TRACE_MALLOC, ptr, 0, size);
+    record_latency(LATENCY_MALLOC, start);
+
+    return ptr;
+}
+
+/**
+ * @brief      Frees memory. See free_internal(); with ALLOCATOR_LATENCY=1 the call is also timed,
+ *              and with ALLOCATOR_TRACE set it is recorded.
+ *
+ * @param      ptr   ptr to block of data
+ */
+void free(void *ptr)
+{
+    if (!g_latency_enabled && !g_trace_enabled) {
+        free_internal(ptr);
+        return;
+    }
+
+    uint64_t start = read_cycles();
+    trace_record(TRACE_FREE, ptr, 0, 0);
+    free_internal(ptr);
+    record_latency(LATENCY_FREE, start);
+}
+
+/**
+ * @brief      Allocates zeroed memory. See calloc_internal(); with ALLOCATOR_LATENCY=1 the call is
+ *              also timed, and with ALLOCATOR_TRACE set it is recorded.
+ *
+ * @param[in]  nmemb  number of members
+ * @param[in]  size   size of each member
+ *
+ * @return     pointer to block of data
+ */
+void *calloc(size_t nmemb, size_t size)
+{
+    if (!g_latency_enabled && !g_trace_enabled) {
+        return calloc_internal(nmemb, size);
+    }
+
+    uint64_t start = read_cycles();
+    void *ptr = calloc_internal(nmemb, size);
+    trace_record(TRACE_CALLOC, ptr, nmemb, size);
+    record_latency(LATENCY_CALLOC, start);
+
+    return ptr;
+}
+
+/**
+ * @brief      Resizes memory. See realloc_internal(); with ALLOCATOR_LATENCY=1 the call is also
+ *              timed, and with ALLOCATOR_TRACE set it is recorded.
+ *
+ * @param      ptr   pointer to data block
+ * @param[in]  size  requested size
+ *
+ * @return     pointer to the resized data
+ */
+void *realloc(void *ptr, size_t size)
+{
+    if (!g_latency_enabled && !g_trace_enabled) {
+        return realloc_internal(ptr, size);
+    }
+
+    // The old pointer is freed inside the call, so no other record may be written until this one is
+    uint64_t start = read_cycles();
+    bool traced = trace_begin();
+    void *new_ptr = realloc_internal(ptr, size);
+    trace_end(traced, TRACE_REALLOC, new_ptr, (uintptr_t) ptr, size);
+    record_latency(LATENCY_REALLOC, start);
+
+    return new_ptr;
+}
+
+/**
+ * @brief      Allocates size bytes aligned to alignment (C11). See aligned_alloc_internal().
+ *
+ * @param[in]  alignment  power of two
+ * @param[in]  size       requested size
+ *
+ * @return     aligned data block, or NULL on failure
+ */
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    if (!g_latency_enabled && !g_trace_enabled) {
+        return aligned_alloc_internal(alignment, size);
+    }
+
+    uint64_t start = read_cycles();
+    void *ptr = aligned_alloc_internal(alignment, size);
+    trace_record(TRACE_ALIGNED, ptr, alignment, size);
+    record_latency(LATENCY_MALLOC, start);
+
+    return ptr;
+}
+
+/**
+ * @brief      Obsolete name for aligned_alloc(), still used by plenty of C code
+ *
+ * @param[in]  alignment  power of two
+ * @param[in]  size       requested size
+ *
+ * @return     aligned data block, or NULL on failure
+ */
+void *memalign(size_t alignment, size_t size)
+{
+    return aligned_alloc(alignment, size);
+}
+
+/**
+ * @brief      POSIX aligned allocation
+ *
+ * @param      memptr     where to store the allocation
+ * @param[in]  alignment  power of two multiple of sizeof(void *)
+ * @param[in]  size       requested size
+ *
+ * @return     0 on success, EINVAL for a bad alignment, ENOMEM if memory ran out
+ */
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0) {
+        return EINVAL;
+    }
+
+    void *ptr = aligned_alloc(alignment, size);
+
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+
+    *memptr = ptr;
+    return 0;
+}
+
+/**
+ * @brief      Frees ptr, which was allocated with size bytes (C23). See free_sized_internal().
+ *
+ * @param      ptr   pointer to free
+ * @param[in]  size  size it was allocated with
+ */
+void free_sized(void *ptr, size_t size)
+{
+    if (!g_latency_enabled && !g_trace_enabled) {
+        free_sized_internal(ptr, size);
+        return;
+    }
+
+    uint64_t start = read_cycles();
+    trace_record(TRACE_FREE, ptr, 0, size);
+    free_sized_internal(ptr, size);
+    record_latency(LATENCY_FREE, start);
+}
+
+/**
+ * @brief      Frees ptr, which was allocated with aligned_alloc(alignment, size) (C23)
+ *
+ * @param      ptr        pointer to free
+ * @param[in]  alignment  alignment it was allocated with
+ * @param[in]  size       size it was allocated with
+ */
+void free_aligned_sized(void *ptr, size_t alignment, size_t size)
+{
+    (void) alignment; // aligned blocks are ordinary blocks once carved
+    free_sized(ptr, size);
+}
+
+/**
+ * @brief      Gets how many bytes can be used at ptr, which may be more than was asked for
+ *
+ * @param      ptr   pointer returned by one of our allocation functions
+ *
+ * @return     usable size, or 0 for NULL
+ */
+size_t malloc_usable_size(void *ptr)
+{
+    return usable_size_internal(ptr);
+}
+
+/**
+ * @brief      Copies the allocator's counters into stats
+ *
+ * @param      stats  where to copy the counters
+ */
+void get_allocator_stats(struct allocator_stats *stats)
+{
+    pthread_mutex_lock(&alloc_mutex);
+    get_fit_isa();
+    *stats = g_stats;
+    pthread_mutex_unlock(&alloc_mutex);
+
+    add_magazine_stats(stats);
+    add_guard_stats(stats);
+}
+
+/**
+ * @brief      Copies the metadata of every block in the list into snapshot. The list is walked
+ *              once while holding alloc_mutex; everything else (sizing the buffer, formatting)
+ *              happens without the lock.
+ *
+ * @param      snapshot  snapshot to fill in. Release it with release_snapshot()
+ *
+ * @return     0 on success, -1 if the record buffer could not be mapped
+ */
+int take_snapshot(struct heap_snapshot *snapshot)
+{
+    size_t capacity = 64;
+
+    while (true) {
+        size_t map_size = get_region_size(capacity * sizeof(struct block_record));
+        struct block_record *records = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (records == MAP_FAILED) {
+            return -1;
+        }
+        capacity = map_size / sizeof(struct block_record);
+
+        pthread_mutex_lock(&alloc_mutex);
+
+        // Case: heap grew past our buffer - drop the lock and try again with room to spare
+        if (g_blocks > capacity) {
+            capacity = g_blocks * 2;
+            pthread_mutex_unlock(&alloc_mutex);
+            munmap(records, map_size);
+            continue;
+        }
+
+        size_t count = 0;
+        struct mem_block *current = g_head;
+
+        while (current != NULL) {
+            records[count].addr = current;
+            records[count].size = current->size;
+            records[count].region_id = current->region_id;
+            records[count].free = current->free;
+            memcpy(records[count].name, current->name, sizeof(records[count].name) - 1);
+            records[count].name[sizeof(records[count].name) - 1] = '\0';
+
+            count++;
+            current = current->next;
+        }
+
+        get_fit_isa();
+        snapshot->stats = g_stats;
+        pthread_mutex_unlock(&alloc_mutex);
+
+        add_magazine_stats(&snapshot->stats);
+        add_guard_stats(&snapshot->stats);
+
+        snapshot->records = records;
+        snapshot->count = count;
+        snapshot->map_size = map_size;
+        return 0;
+    }
+}
+
+/**
+ * @brief      Unmaps the record buffer of a snapshot taken with take_snapshot()
+ *
+ * @param      snapshot  snapshot
+ */
+void release_snapshot(struct heap_snapshot *snapshot)
+{
+    if (snapshot->records != NULL) {
+        munmap(snapshot->records, snapshot->map_size);
+    }
+
+    snapshot->records = NULL;
+    snapshot->count = 0;
+    snapshot->map_size = 0;
+}
+
+/**
+ * @brief      Prints out memory
+ *
+ * @note       Works from a snapshot, so the list is never read without the lock and the printing
+ *              itself (which may allocate) happens after the lock has been released.
+ */
+void print_memory(void)
+{
+    struct heap_snapshot snapshot;
+
+    if (take_snapshot(&snapshot) == -1) {
+        perror("mmap");
+        return;
+    }
+
+    puts("-- Current Memory State --");
+
+    unsigned long current_region = 0;
+
+    for (size_t i = 0; i < snapshot.count; i++) {
+        struct block_record *record = &snapshot.records[i];
+
+        // Case: New region - print out region string
+        if (record->region_id != current_region || i == 0) {
+            printf("[REGION %lu] %p \n", record->region_id, record->addr);
+            current_region = record->region_id;
+        }
+
+        printf("    [BLOCK] %p-%p in region %lu '%s' %zu [%s] -> %p\n",
+                record->addr,
+                (struct mem_block *) ( (char *)record->addr + record->size ), // do (char *) instead of (void *) b/c char * does 1 byte, whereas void * is undefined/platform-specific
+                record->region_id,
+                record->name,
+                record->size,
+                record->free ? "FREE" : "USED",
+                i + 1 < snapshot.count ? snapshot.records[i + 1].addr : NULL);
+    }
+
+    release_snapshot(&snapshot);
+}
+
+/**
+ * Small buffered writer used to emit JSON without going through stdio (which may call back into
+ * malloc).
+ */
+struct json_writer {
+    int fd;
+    ssize_t written;
+    bool failed;
+    size_t len;
+    char buf[4096];
+};
+
+/**
+ * @brief      Writes out whatever is buffered in writer
+ *
+ * @param      writer  writer
+ */
+void jw_flush(struct json_writer *writer)
+{
+    size_t offset = 0;
+
+    while (offset < writer->len && !writer->failed) {
+        ssize_t result = write(writer->fd, writer->buf + offset, writer->len - offset);
+
+        if (result == -1) {
+            writer->failed = true;
+            break;
+        }
+
+        offset += result;
+        writer->written += result;
+    }
+
+    writer->len = 0;
+}
+
+/**
+ * @brief      printf()s into writer's buffer, flushing it first if the output doesn't fit
+ *
+ * @param      writer  writer
+ * @param[in]  fmt     printf-style format string
+ */
+void jw_printf(struct json_writer *writer, const char *fmt, ...)
+{
+    va_list args;
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        size_t space = sizeof(writer->buf) - writer->len;
+
+        va_start(args, fmt);
+        int needed = vsnprintf(writer->buf + writer->len, space, fmt, args);
+        va_end(args);
+
+        if (needed < 0) {
+            writer->failed = true;
+            return;
+        }
+
+        if ((size_t) needed < space) {
+            writer->len += needed;
+            return;
+        }
+
+        // Case: didn't fit - flush and try again with an empty buffer
+        jw_flush(writer);
+    }
+
+    // Case: a single piece of output larger than the whole buffer; nothing we emit gets there
+    writer->failed = true;
+}
+
+/**
+ * @brief      Gets the index of the highest set bit in size, i.e. the power-of-two bucket it
+ *              falls into
+ *
+ * @param[in]  size  size (must not be 0)
+ *
+ * @return     floor(log2(size))
+ */
+int get_size_bucket(size_t size)
+{
+    return (int) (sizeof(size_t) * CHAR_BIT - 1) - __builtin_clzl(size);
+}
+
+/**
+ * @brief      Writes the allocator's counters, including the adaptive policy's per-class
+ *              decisions, as a JSON object
+ *
+ * @param      writer  writer
+ * @param      stats   counters to write
+ */
+void write_stats_json(struct json_writer *writer, struct allocator_stats *stats)
+{
+    jw_printf(writer,
+            "{\"allocations\":%lu,\"frees\":%lu,\"regions_mapped\":%lu,\"regions_unmapped\":%lu,"
+            "\"regions_extended\":%lu,\"mappings_merged\":%lu,"
+            "\"fit_searches\":%lu,\"fit_steps\":%lu,\"fit_isa\":\"%s\","
+            "\"guarded_allocations\":%lu,\"guarded_frees\":%lu,"
+            "\"reserved_bytes\":%zu,\"reallocs_in_place\":%lu,\"slack_reservations\":%lu,"
+            "\"slack_reclaims\":%lu,\"mem_limit\":%zu,\"soft_limit\":%zu,\"mapped_bytes\":%zu,"
+            "\"purged_bytes\":%zu,\"pressure_events\":%lu,\"limit_events\":%lu,\"purges\":%lu,"
+            "\"magazine_allocations\":%lu,\"magazine_frees\":%lu,\"depot_exchanges\":%lu,"
+            "\"magazine_flushes\":%lu",
+            stats->allocations, stats->frees, stats->regions_mapped, stats->regions_unmapped,
+            stats->regions_extended, stats->mappings_merged, stats->fit_searches, stats->fit_steps,
+            get_fit_isa_name(stats->fit_isa),
+            stats->guarded_allocations, stats->guarded_frees,
+            stats->reserved_bytes, stats->reallocs_in_place, stats->slack_reservations,
+            stats->slack_reclaims, stats->mem_limit, stats->soft_limit, stats->mapped_bytes,
+            stats->purged_bytes, stats->pressure_events, stats->limit_events, stats->purges,
+            stats->magazine_allocations, stats->magazine_frees, stats->depot_exchanges,
+            stats->magazine_flushes);
+
+    jw_printf(writer, ",\"fit_classes\":[");
+
+    bool first_class = true;
+
+    for (int size_class = 0; size_class < FIT_CLASSES; size_class++) {
+        struct fit_class_stats *class_stats = &stats->fit_classes[size_class];
+
+        if (class_stats->allocations == 0) {
+            continue;
+        }
+
+        jw_printf(writer,
+                "%s{\"min\":%zu,\"policy\":\"%s\",\"previous_policy\":\"%s\",\"allocations\":%lu,"
+                "\"windows\":%lu,\"switches\":%lu,\"search_length\":%.2f,\"fragmentation\":%.4f,"
+                "\"sliver_ratio\":%.4f}",
+                first_class ? "" : ",", (size_t) 1 << size_class,
+                get_fit_policy_name(class_stats->policy),
+                class_stats->switches > 0 ? get_fit_policy_name(class_stats->previous_policy) : "none",
+                class_stats->allocations, class_stats->windows, class_stats->switches,
+                class_stats->search_length, class_stats->fragmentation, class_stats->sliver_ratio);
+        first_class = false;
+    }
+
+    jw_printf(writer, "]}");
+}
+
+/**
+ * @brief      Merges every thread's latency histograms and writes them as a JSON object, one entry
+ *              per (operation, outcome) pair that has been seen. Bucket b counts calls that took
+ *              [2^b, 2^(b+1)) LATENCY_UNITs; percentiles report the upper bound of their bucket.
+ *
+ * @param      writer  writer
+ */
+void write_latency_json(struct json_writer *writer)
+{
+    static const char *op_names[LATENCY_OPS] = { "malloc", "free", "realloc", "calloc" };
+    static const char *outcome_names[LATENCY_OUTCOMES] = {
+        "list", "new_region", "unmap", "in_place", "moved", "guarded", "foreign", "magazine"
+    };
+    static const double percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    static const char *percentile_names[] = { "p50", "p90", "p99", "p999" };
+
+    unsigned long merged[LATENCY_OPS][LATENCY_OUTCOMES][LATENCY_BUCKETS] = { 0 };
+
+    struct latency_histograms *histograms = __atomic_load_n(&g_latency_threads, __ATOMIC_ACQUIRE);
+
+    for (; histograms != NULL; histograms = histograms->next) {
+        for (int op = 0; op < LATENCY_OPS; op++) {
+            for (int outcome = 0; outcome < LATENCY_OUTCOMES; outcome++) {
+                for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+                    merged[op][outcome][bucket] += histograms->counts[op][outcome][bucket];
+                }
+            }
+        }
+    }
+
+    jw_printf(writer, "{\"unit\":\"%s\",\"histograms\":[", LATENCY_UNIT);
+
+    bool first_histogram = true;
+
+    for (int op = 0; op < LATENCY_OPS; op++) {
+        for (int outcome = 0; outcome < LATENCY_OUTCOMES; outcome++) {
+            unsigned long *counts = merged[op][outcome];
+            unsigned long total = 0;
+
+            for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+                total += counts[bucket];
+            }
+
+            if (total == 0) {
+                continue;
+            }
+
+            jw_printf(writer, "%s{\"op\":\"%s\",\"outcome\":\"%s\",\"count\":%lu",
+                    first_histogram ? "" : ",", op_names[op], outcome_names[outcome], total);
+            first_histogram = false;
+
+            unsigned long seen = 0;
+            int bucket = 0;
+
+            for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+                unsigned long rank = (unsigned long) (percentiles[i] * total);
+
+                while (bucket < LATENCY_BUCKETS - 1 && seen + counts[bucket] <= rank) {
+                    seen += counts[bucket];
+                    bucket++;
+                }
+
+                jw_printf(writer, ",\"%s\":%llu", percentile_names[i], (2ULL << bucket) - 1);
+            }
+
+            jw_printf(writer, ",\"buckets\":[");
+
+            bool first_bucket = true;
+
+            for (int b = 0; b < LATENCY_BUCKETS; b++) {
+                if (counts[b] == 0) {
+                    continue;
+                }
+
+                jw_printf(writer, "%s{\"min\":%llu,\"count\":%lu}", first_bucket ? "" : ",", 1ULL << b, counts[b]);
+                first_bucket = false;
+            }
+
+            jw_printf(writer, "]}");
+        }
+    }
+
+    jw_printf(writer, "]}");
+}
+
+/**
+ * @brief      Writes the merged latency histograms (see write_latency_json()) to fd, without the
+ *              rest of the heap snapshot. Cheap enough to poll often: no allocator lock is taken.
+ *
+ * @param[in]  fd    file descriptor to write to
+ *
+ * @return     number of bytes written, or -1 on error (including when ALLOCATOR_LATENCY is off)
+ */
+ssize_t write_latency_snapshot(int fd)
+{
+    if (!g_latency_enabled) {
+        return -1;
+    }
+
+    struct json_writer writer = { .fd = fd };
+
+    write_latency_json(&writer);
+    jw_printf(&writer, "\n");
+    jw_flush(&writer);
+
+    return writer.failed ? -1 : writer.written;
+}
+
+/**
+ * @brief      Writes a machine-readable JSON snapshot of the heap to fd. The snapshot contains
+ *              per-region occupancy, a histogram of free block sizes (power-of-two buckets),
+ *              external fragmentation (1 - largest free block / total free) and the ratio of
+ *              header bytes to heap bytes.
+ *
+ * @param[in]  fd    file descriptor to write to
+ *
+ * @return     number of bytes written, or -1 on error
+ */
+ssize_t write_heap_snapshot(int fd)
+{
+    struct heap_snapshot snapshot;
+
+    if (take_snapshot(&snapshot) == -1) {
+        return -1;
+    }
+
+    struct json_writer writer = { .fd = fd };
+
+    size_t histogram_count[sizeof(size_t) * CHAR_BIT] = { 0 };
+    size_t histogram_bytes[sizeof(size_t) * CHAR_BIT] = { 0 };
+
+    size_t total_size = 0;
+    size_t total_free = 0;
+    size_t largest_free = 0;
+    size_t free_blocks = 0;
+    size_t regions = 0;
+
+    jw_printf(&writer, "{\"regions\":[");
+
+    for (size_t i = 0; i < snapshot.count; ) {
+        struct block_record *first = &snapshot.records[i];
+
+        size_t region_size = 0;
+        size_t region_free = 0;
+        size_t region_blocks = 0;
+        size_t region_free_blocks = 0;
+
+        // Blocks of a region are contiguous in the list, so aggregate until the id changes
+        for (; i < snapshot.count && snapshot.records[i].region_id == first->region_id; i++) {
+            struct block_record *record = &snapshot.records[i];
+
+            region_size += record->size;
+            region_blocks++;
+
+            if (record->free) {
+                int bucket = get_size_bucket(record->size);
+
+                histogram_count[bucket]++;
+                histogram_bytes[bucket] += record->size;
+
+                region_free += record->size;
+                region_free_blocks++;
+
+                if (record->size > largest_free) {
+                    largest_free = record->size;
+                }
+            }
+        }
+
+        jw_printf(&writer,
+                "%s{\"id\":%lu,\"address\":\"%p\",\"size\":%zu,\"used\":%zu,\"free\":%zu,"
+                "\"blocks\":%zu,\"free_blocks\":%zu,\"occupancy\":%.4f}",
+                regions > 0 ? "," : "",
+                first->region_id, (void *) first->addr, region_size,
+                region_size - region_free, region_free,
+                region_blocks, region_free_blocks,
+                region_size > 0 ? (double) (region_size - region_free) / region_size : 0.0);
+
+        total_size += region_size;
+        total_free += region_free;
+        free_blocks += region_free_blocks;
+        regions++;
+    }
+
+    jw_printf(&writer, "],\"free_histogram\":[");
+
+    bool first_bucket = true;
+
+    for (int bucket = 0; bucket < (int) (sizeof(size_t) * CHAR_BIT); bucket++) {
+        if (histogram_count[bucket] == 0) {
+            continue;
+        }
+
+        size_t min = (size_t) 1 << bucket;
+        size_t max = bucket + 1 < (int) (sizeof(size_t) * CHAR_BIT) ? (min << 1) - 1 : SIZE_MAX;
+
+        jw_printf(&writer, "%s{\"min\":%zu,\"max\":%zu,\"count\":%zu,\"bytes\":%zu}",
+                first_bucket ? "" : ",", min, max, histogram_count[bucket], histogram_bytes[bucket]);
+        first_bucket = false;
+    }
+
+    jw_printf(&writer, "],\"stats\":");
+    write_stats_json(&writer, &snapshot.stats);
+
+    if (g_latency_enabled) {
+        jw_printf(&writer, ",\"latency\":");
+        write_latency_json(&writer);
+    }
+
+    size_t header_bytes = snapshot.count * sizeof(struct mem_block);
+
+    jw_printf(&writer,
+            ",\"region_count\":%zu,\"blocks\":%zu,\"free_blocks\":%zu,"
+            "\"total_size\":%zu,\"total_used\":%zu,\"total_free\":%zu,\"largest_free\":%zu,"
+            "\"external_fragmentation\":%.4f,\"header_bytes\":%zu,\"header_overhead\":%.4f}\n",
+            regions, snapshot.count, free_blocks,
+            total_size, total_size - total_free, total_free, largest_free,
+            total_free > 0 ? 1.0 - (double) largest_free / total_free : 0.0,
+            header_bytes,
+            total_size > 0 ? (double) header_bytes / total_size : 0.0);
+
+    jw_flush(&writer);
+    release_snapshot(&snapshot);
+
+    return writer.failed ? -1 : writer.written;
+}
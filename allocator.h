@@ -9,21 +9,76 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
 
 /* -- Helper functions -- */
 struct mem_block *split_block(struct mem_block *block, size_t size);
 struct mem_block *merge_block(struct mem_block *block);
+void *find_fit(size_t size, bool counted);
+void *take_fit(struct mem_block *found, size_t size);
 void *reuse(size_t size);
 void *first_fit(size_t size);
 void *worst_fit(size_t size);
 void *best_fit(size_t size);
+void *adaptive_fit(size_t size);
+void *fit_with_policy(int policy, size_t size);
+void *claim_reserved_fit(size_t size);
+void adapt_fit_policy(int size_class);
+const char *get_fit_policy_name(int policy);
 void print_memory(void);
+void report_error(const char *fmt, ...);
+
+/* -- Heap introspection -- */
+struct allocator_stats;
+struct heap_snapshot;
+void get_allocator_stats(struct allocator_stats *stats);
+int take_snapshot(struct heap_snapshot *snapshot);
+void release_snapshot(struct heap_snapshot *snapshot);
+ssize_t write_heap_snapshot(int fd);
+
+/* -- Initialization -- */
+void allocator_init(void);
+void allocator_fini(void);
+bool parse_size(const char *name, size_t *bytes);
+void init_reserve(void);
+void init_mem_limit(void);
 
 /* -- C Memory API functions -- */
 void *malloc(size_t size);
 void free(void *ptr);
 void *calloc(size_t nmemb, size_t size);
 void *realloc(void *ptr, size_t size);
+void *aligned_alloc(size_t alignment, size_t size);
+void *memalign(size_t alignment, size_t size);
+int posix_memalign(void **memptr, size_t alignment, size_t size);
+void free_sized(void *ptr, size_t size);
+void free_aligned_sized(void *ptr, size_t alignment, size_t size);
+size_t malloc_usable_size(void *ptr);
+
+void *malloc_internal(size_t size);
+void free_internal(void *ptr);
+void free_pointer(void *ptr, bool sized, size_t size);
+void *calloc_internal(size_t nmemb, size_t size);
+void *realloc_internal(void *ptr, size_t size);
+void *aligned_alloc_internal(size_t alignment, size_t size);
+void free_sized_internal(void *ptr, size_t size);
+size_t usable_size_internal(void *ptr);
+
+/* -- Latency histograms -- */
+void init_latency(void);
+void release_thread_latency(void *histograms);
+void record_latency(int op, uint64_t start);
+ssize_t write_latency_snapshot(int fd);
+
+/* -- Allocation tracing -- */
+void init_trace(void);
+void disable_trace_in_child(void);
+bool trace_begin(void);
+void trace_end(bool traced, int op, void *ptr, uint64_t arg, size_t size);
+void trace_record(int op, void *ptr, uint64_t arg, size_t size);
+void flush_trace(void);
 
 /* -- Linked List utility functions -- */
 
@@ -37,8 +92,330 @@ bool blocks_can_merge(struct mem_block *block, struct mem_block *neighbor);
 void *get_data_from_header(struct mem_block *header);
 struct mem_block *get_header_from_data(void *data);
 
+/* -- Page map / region ownership -- */
+struct mem_region;
+struct mem_region *pagemap_lookup(void *ptr);
+bool pagemap_set(void *start, size_t size, struct mem_region *region);
+size_t get_region_size(size_t real_size);
+struct mem_region *register_region(void *base, size_t size, int kind);
+void unregister_region(struct mem_region *region);
+struct mem_region *adopt_mapping(void *base, size_t size, int kind);
+void drop_mapping(struct mem_region *region);
+void release_region(struct mem_region *region);
+bool block_is_valid(struct mem_region *region, struct mem_block *block);
+struct mem_block *get_first_block(struct mem_region *region);
+void region_used_run(struct mem_region *region, size_t used);
+void region_freed_run(struct mem_region *region, size_t freed);
+void libc_free(void *ptr);
+void *libc_realloc(void *ptr, size_t size);
+
+/* -- Free index -- */
+bool block_precedes(struct mem_block *block, struct mem_block *other);
+size_t free_index_find(struct mem_block *block, bool *found);
+bool free_index_grow(void);
+void free_index_add(struct mem_block *block);
+void free_index_remove(struct mem_block *block);
+void free_index_update(struct mem_block *block);
+void free_index_replace(struct mem_block *block, struct mem_block *replacement);
+int get_fit_isa(void);
+const char *get_fit_isa_name(int isa);
+size_t scan_first_fit(const size_t *sizes, size_t count, size_t size);
+size_t scan_best_fit(const size_t *sizes, size_t count, size_t size);
+size_t scan_worst_fit(const size_t *sizes, size_t count, size_t size);
+
+/* -- Memory limit and purging -- */
+ssize_t read_small_file(const char *path, char *buf, size_t size);
+size_t read_cgroup_limit(void);
+size_t get_heap_usage(void);
+bool under_pressure(size_t request);
+bool get_purge_range(struct mem_block *block, char **start, size_t *length);
+void purge_block(struct mem_block *block);
+void purge_if_pressured(struct mem_block *block);
+void unpurge_block(struct mem_block *block);
+void unmap_heap_region(struct mem_region *region, struct mem_block *block);
+bool relieve_pressure(size_t request);
+
+/* -- Magazines -- */
+void init_magazines(void);
+struct magazine_cache *get_thread_magazines(void);
+void release_thread_magazines(void *cache);
+struct mem_block *magazine_alloc(size_t real_size);
+bool magazine_free(struct mem_region *region, struct mem_block *block, size_t real_size);
+struct magazine *swap_empty_magazine(size_t size_class, struct magazine *empty);
+struct magazine *swap_full_magazine(size_t size_class, struct magazine *full);
+struct magazine *pop_empty_magazine(size_t size_class);
+void flush_magazine(struct magazine *magazine);
+void deposit_magazine(size_t size_class, struct magazine *magazine);
+void drain_depots(void);
+void add_magazine_stats(struct allocator_stats *stats);
+bool release_block(struct mem_region *region, struct mem_block *block);
+
+/* -- Sampled guard-page allocations -- */
+void init_sampling(void);
+long next_sample_interval(void);
+void *sample_allocation(size_t size);
+bool init_guard_pool(void);
+char *get_guard_slot_page(int slot);
+void *guarded_malloc(size_t size);
+int get_guard_slot(const void *ptr);
+size_t guarded_size(void *ptr);
+void guarded_free(void *ptr);
+void add_guard_stats(struct allocator_stats *stats);
+void report_guard_stack(const char *what, pid_t tid, void **stack, int depth);
+
+/* -- Persistent heap -- */
+struct pheap;
+struct pheap *pheap_open(const char *path, size_t size);
+void pheap_close(struct pheap *heap);
+void *pheap_alloc(struct pheap *heap, size_t size);
+void pheap_free(struct pheap *heap, void *ptr);
+uint64_t pheap_offset(struct pheap *heap, void *ptr);
+void *pheap_pointer(struct pheap *heap, uint64_t offset);
+void *pheap_get_root(struct pheap *heap);
+void pheap_set_root(struct pheap *heap, void *ptr);
+int pheap_sync(struct pheap *heap);
+
+/* -- Tunables -- */
+
+/** Alignment of the data in every heap block (make ALIGN=...) */
+#ifndef BLOCK_ALIGN
+#define BLOCK_ALIGN 16
+#endif
+
+#if BLOCK_ALIGN < 16 || BLOCK_ALIGN > 4096 || (BLOCK_ALIGN & (BLOCK_ALIGN - 1)) != 0
+#error "BLOCK_ALIGN must be a power of two from 16 (alignof(max_align_t)) to 4096"
+#endif
+
+/**
+ * Bytes of padding at the end of each block header (make HEADER_PADDING=...). The default makes the
+ * header 100 bytes, which the tests expect; 0 gives the smallest header.
+ */
+#ifndef HEADER_PADDING
+#define HEADER_PADDING 27
+#endif
+
+/** Number of size classes tracked by the adaptive policy (one per power of two) */
+#define FIT_CLASSES 64
+
+/** Allocations in a size class between two adaptive policy decisions */
+#define ADAPTIVE_WINDOW 256
+
+/** Fragmentation (1 - largest free / total free) above which packing matters more than speed */
+#define ADAPTIVE_FRAG_HIGH 0.5
+
+/** Fragmentation below which the adaptive policy goes back to first fit */
+#define ADAPTIVE_FRAG_LOW 0.2
+
+/** Average blocks visited per first fit search that counts as a long walk */
+#define ADAPTIVE_SEARCH_LONG 32
+
+/** Share of free blocks too small for a class above which best fit is leaving slivers */
+#define ADAPTIVE_SLIVER_HIGH 0.5
+
+/** Share of too-small free blocks below which slivers are no longer a concern */
+#define ADAPTIVE_SLIVER_LOW 0.2
+
+/** Bits of a user-space virtual address (x86-64 / AArch64 with 4-level tables) */
+#define PAGEMAP_ADDRESS_BITS 47
+
+/** log2 of the page size tracked by the page map */
+#define PAGEMAP_PAGE_SHIFT 12
+
+/** Page number bits resolved by the page map's root */
+#define PAGEMAP_ROOT_BITS 17
+
+/** Page number bits resolved by each leaf */
+#define PAGEMAP_LEAF_BITS (PAGEMAP_ADDRESS_BITS - PAGEMAP_PAGE_SHIFT - PAGEMAP_ROOT_BITS)
+
+#define PAGEMAP_ROOT_SIZE (1UL << PAGEMAP_ROOT_BITS)
+#define PAGEMAP_LEAF_SIZE (1UL << PAGEMAP_LEAF_BITS)
+
+/** Number of page-sized slots in the guard pool used by ALLOCATOR_SAMPLE_RATE */
+#define GUARD_SLOTS 256
+
+/** Return addresses kept for each guarded allocation and free */
+#define GUARD_STACK_DEPTH 16
+
+/**
+ * Alignment of guarded allocations (they are pushed against the following guard page). The same
+ * as any other block's, since malloc() can't tell the caller which one it got.
+ */
+#define GUARD_ALIGN BLOCK_ALIGN
+
+/** Number of log2 buckets in each latency histogram (enough for any 64-bit duration) */
+#define LATENCY_BUCKETS 64
+
+/** What read_cycles() counts */
+#if defined(__x86_64__) || defined(__i386__)
+#define LATENCY_UNIT "cycles"
+#elif defined(__aarch64__)
+#define LATENCY_UNIT "ticks"
+#else
+#define LATENCY_UNIT "ns"
+#endif
+
+/** realloc() calls an allocation needs before growing it also reserves slack after it */
+#define REALLOC_SLACK_AFTER 2
+
+/** Most slack reserved after a single growing allocation */
+#define REALLOC_SLACK_MAX (1 << 20)
+
+/** Soft watermark, as a percentage of ALLOCATOR_MEM_LIMIT, when ALLOCATOR_SOFT_LIMIT isn't set */
+#define MEM_SOFT_PERCENT 80
+
+/** Smallest free run purged while the heap is between the soft watermark and the limit */
+#define PURGE_MIN_RUN (64 << 10)
+
+/** cgroup limits at or above this are "no limit" (cgroup v1 reports unlimited as ~2^63) */
+#define CGROUP_UNLIMITED ((size_t) 1 << 60)
+
+/** Largest block (header included) ALLOCATOR_MAGAZINES caches */
+#define MAGAZINE_MAX_SIZE 1024
+
+/** Magazine size classes: a block's class is its size / BLOCK_ALIGN */
+#define MAGAZINE_CLASSES (MAGAZINE_MAX_SIZE / BLOCK_ALIGN + 1)
+
+/** Blocks a magazine holds */
+#define MAGAZINE_ROUNDS 32
+
+/** Full magazines the depot keeps per size class; past that, they're emptied into the heap */
+#define MAGAZINE_DEPOT_MAX 8
+
+/** First bytes of every ALLOCATOR_TRACE file */
+#define TRACE_MAGIC "ALLOCTR"
+
+/** Layout version of trace files */
+#define TRACE_VERSION 1
+
+/** Trace records buffered in memory before they're written out */
+#define TRACE_BUFFER_RECORDS 4096
+
+/** First bytes of every persistent heap file */
+#define PHEAP_MAGIC "PHEAP01"
+
+/** Layout version of persistent heap files; files with another version are refused */
+#define PHEAP_VERSION 1
+
+/** Alignment of persistent heap blocks and the data in them */
+#define PHEAP_ALIGN 16
+
+/** Value of mem_block.magic for every header that starts a block in the list */
+#define BLOCK_MAGIC 0xA110CA7EU
+
+/** Value of mem_block.magic while a freed block sits in a magazine; the heap still counts it as used */
+#define MAGAZINE_MAGIC 0xCAC4EDB1U
+
 /* -- Data Structures -- */
 
+/**
+ * Free space management algorithms. FIT_FIRST is 0 so zeroed state defaults to first fit.
+ */
+enum fit_policy {
+    FIT_FIRST = 0,
+    FIT_BEST,
+    FIT_WORST,
+};
+
+/**
+ * Instruction sets the free index can be scanned with, from slowest to fastest. The best one the
+ * CPU supports is picked at run time; ALLOCATOR_FIT_ISA can ask for a slower one.
+ */
+enum fit_isa {
+    FIT_ISA_SCALAR = 0,
+    FIT_ISA_SSE42,
+    FIT_ISA_AVX2,
+};
+
+/**
+ * Operations timed when ALLOCATOR_LATENCY=1.
+ */
+enum latency_op {
+    LATENCY_MALLOC = 0,
+    LATENCY_FREE,
+    LATENCY_REALLOC,
+    LATENCY_CALLOC,
+    LATENCY_OPS
+};
+
+/**
+ * Code path a timed call took. Each (operation, outcome) pair gets its own histogram.
+ */
+enum latency_outcome {
+    /** Served from, or returned to, the block list without a system call */
+    OUTCOME_LIST = 0,
+    /** Had to map a new region */
+    OUTCOME_NEW_REGION,
+    /** Freed the last block of a region and unmapped it */
+    OUTCOME_UNMAP,
+    /** realloc() resized the block without moving it */
+    OUTCOME_IN_PLACE,
+    /** realloc() copied the data to a new block */
+    OUTCOME_MOVED,
+    /** Sampled allocation served from, or returned to, the guard pool */
+    OUTCOME_GUARDED,
+    /** Pointer belonged to libc and was passed on */
+    OUTCOME_FOREIGN,
+    /** Served from, or cached in, one of the thread's magazines without taking alloc_mutex */
+    OUTCOME_MAGAZINE,
+    LATENCY_OUTCOMES
+};
+
+/**
+ * Calls recorded by ALLOCATOR_TRACE.
+ */
+enum trace_op {
+    TRACE_MALLOC = 0,
+    TRACE_FREE,
+    TRACE_REALLOC,
+    TRACE_CALLOC,
+    /** aligned_alloc(), memalign() and posix_memalign() */
+    TRACE_ALIGNED,
+};
+
+/**
+ * What a page map entry points at. Only REGION_HEAP regions are laid out as mem_block lists;
+ * other kinds are free to manage their pages without headers.
+ */
+enum region_kind {
+    REGION_HEAP = 0,
+    REGION_GUARD,
+    /** A persistent heap file mapped by pheap_open(); its blocks are pheap_blocks */
+    REGION_PERSISTENT,
+};
+
+/**
+ * Describes one mapping owned by the allocator. Descriptors live outside the mapping they
+ * describe, and every page of the mapping points to its descriptor through the page map.
+ */
+struct mem_region {
+    /** Start of the mapping */
+    void *base;
+
+    /** Size of the mapping, in bytes */
+    size_t size;
+
+    /** region_id shared by every block in this region */
+    unsigned long id;
+
+    /** What the region holds (enum region_kind) */
+    int kind;
+
+    /** Keep the mapping even when every block in it is free (e.g. the ALLOCATOR_RESERVE region) */
+    bool retained;
+
+    /** REGION_HEAP: blocks in use */
+    unsigned long live;
+
+    /** REGION_HEAP: bytes in free blocks, headers included (reserved slack counts as free) */
+    size_t free_bytes;
+
+    /** Previous heap region, in the same order as their blocks in the list */
+    struct mem_region *prev;
+
+    /** Next heap region in list order, or next descriptor in the recycled pool */
+    struct mem_region *next;
+};
+
 /**
  * Defines metadata structure for both memory 'regions' and 'blocks.' This
  * structure is prefixed before each allocation's data area.
@@ -68,14 +445,299 @@ struct mem_block {
     /** Previous block in the chain */
     struct mem_block *prev;
 
+    /**
+     * BLOCK_MAGIC while this header starts a block in the list; used to tell real headers apart
+     * from interior or stale pointers.
+     */
+    unsigned int magic;
+
+    /** Number of times realloc() has been called on this allocation (saturates) */
+    unsigned short reallocs;
+
+    /**
+     * On a free block: slack kept after a growing allocation (see reserve_slack()). Fits skip it
+     * until nothing else is left.
+     */
+    bool reserved;
+
+    /**
+     * On a free block: the whole pages inside it have been given back to the kernel with
+     * madvise() (see purge_block())
+     */
+    bool purged;
+
     /**
      * "Padding" to make the total size of this struct 100 bytes. This serves no
      * purpose other than to make memory address calculations easier. If you
-     * add members to the struct, you should adjust the padding to compensate
+     * add members to the struct, you should adjust HEADER_PADDING to compensate
      * and keep the total size at 100 bytes; test cases and tooling will assume
-     * a 100-byte header.
+     * a 100-byte header. A build with HEADER_PADDING=0 drops it.
      */
-    char padding[35];
+    char padding[HEADER_PADDING];
 } __attribute__((packed));
 
-#endif
\ No newline at end of file
+/**
+ * What the adaptive policy has observed and decided for one size class.
+ */
+struct fit_class_stats {
+    /** Algorithm currently used for this class (enum fit_policy) */
+    int policy;
+
+    /** Algorithm used before the most recent switch. Only meaningful once switches > 0. */
+    int previous_policy;
+
+    /** Allocations searched in this class */
+    unsigned long allocations;
+
+    /** Number of windows evaluated */
+    unsigned long windows;
+
+    /** Number of times the algorithm was changed */
+    unsigned long switches;
+
+    /** Average blocks visited per search during the last window */
+    double search_length;
+
+    /** External fragmentation measured at the end of the last window */
+    double fragmentation;
+
+    /** Share of free blocks too small for this class at the end of the last window */
+    double sliver_ratio;
+};
+
+/**
+ * Counters maintained by the allocator. Read them with get_allocator_stats().
+ */
+struct allocator_stats {
+    /** Calls to malloc() */
+    unsigned long allocations;
+
+    /** Calls to free() with a non-NULL pointer */
+    unsigned long frees;
+
+    /** Regions obtained from mmap() */
+    unsigned long regions_mapped;
+
+    /** Regions given back with munmap() */
+    unsigned long regions_unmapped;
+
+    /** Times the last region was grown in place (MAP_FIXED_NOREPLACE) instead of mapping a new one */
+    unsigned long regions_extended;
+
+    /** New mappings that landed next to a heap region and were merged into it */
+    unsigned long mappings_merged;
+
+    /** Free list searches performed by reuse() */
+    unsigned long fit_searches;
+
+    /** Free index entries examined by all searches */
+    unsigned long fit_steps;
+
+    /** Instruction set the free index is scanned with (enum fit_isa) */
+    int fit_isa;
+
+    /** Sampled allocations served from the guard pool */
+    unsigned long guarded_allocations;
+
+    /** Guarded allocations freed (and quarantined) */
+    unsigned long guarded_frees;
+
+    /** Bytes mapped up front because of ALLOCATOR_RESERVE */
+    size_t reserved_bytes;
+
+    /** realloc() calls that resized the block without moving it */
+    unsigned long reallocs_in_place;
+
+    /** Times slack was reserved after a growing allocation */
+    unsigned long slack_reservations;
+
+    /** Reserved slack blocks handed out by reuse() because nothing else fit */
+    unsigned long slack_reclaims;
+
+    /** ALLOCATOR_MEM_LIMIT (or the cgroup's memory.max), or 0 if there is no limit */
+    size_t mem_limit;
+
+    /** Heap usage above which free memory is given back to the kernel, or 0 if never */
+    size_t soft_limit;
+
+    /** Bytes of heap regions currently mapped */
+    size_t mapped_bytes;
+
+    /** Bytes of free blocks currently given back with madvise(); heap usage is mapped_bytes minus this */
+    size_t purged_bytes;
+
+    /** Times the heap was about to grow past the soft watermark and free memory was purged */
+    unsigned long pressure_events;
+
+    /** Regions mapped even though purging couldn't keep the heap under mem_limit */
+    unsigned long limit_events;
+
+    /** Free runs given back with madvise() */
+    unsigned long purges;
+
+    /** malloc() calls served from a magazine (included in allocations) */
+    unsigned long magazine_allocations;
+
+    /** free() calls that cached their block in a magazine (included in frees) */
+    unsigned long magazine_frees;
+
+    /** Magazines threads swapped with the depot */
+    unsigned long depot_exchanges;
+
+    /** Magazines emptied back into the heap, because the depot was full or memory was short */
+    unsigned long magazine_flushes;
+
+    /** Adaptive policy state, indexed by size class */
+    struct fit_class_stats fit_classes[FIT_CLASSES];
+};
+
+/**
+ * Copy of a single block's metadata, taken while holding the allocator lock.
+ */
+struct block_record {
+    /** Address of the block's header */
+    struct mem_block *addr;
+
+    /** Size of the block, including the header */
+    size_t size;
+
+    /** The region this block belongs to */
+    unsigned long region_id;
+
+    /** Whether or not this block is free */
+    bool free;
+
+    /** The block's name */
+    char name[32];
+};
+
+/**
+ * Point-in-time copy of the block list. The records live in their own mapping so that taking a
+ * snapshot never calls back into malloc().
+ */
+struct heap_snapshot {
+    /** One record per block, in list order */
+    struct block_record *records;
+
+    /** Number of valid records */
+    size_t count;
+
+    /** Size of the mapping backing records */
+    size_t map_size;
+
+    /** Counters, copied under the same lock as the records */
+    struct allocator_stats stats;
+};
+
+/**
+ * Header of a block in a persistent heap. Links are byte offsets from the start of the file (0
+ * meaning none) so the heap stays valid wherever it is mapped.
+ */
+struct pheap_block {
+    /** Size of the block, including this header */
+    uint64_t size;
+
+    /** Offset of the next block in address order */
+    uint64_t next;
+
+    /** Offset of the previous block in address order */
+    uint64_t prev;
+
+    /** BLOCK_MAGIC while this header starts a block */
+    uint32_t magic;
+
+    /** Nonzero if the block is free */
+    uint32_t free;
+
+    /** Keeps the header (and so the data after it) a multiple of PHEAP_ALIGN */
+    char padding[16];
+};
+
+/**
+ * Start of a persistent heap file. Everything in it is shared by the processes that map the file.
+ */
+struct pheap_super {
+    /** PHEAP_MAGIC */
+    char magic[8];
+
+    /** PHEAP_VERSION */
+    uint32_t version;
+
+    /** sizeof(struct pheap_block) when the file was created */
+    uint32_t block_size;
+
+    /** Size of the file */
+    uint64_t size;
+
+    /** Offset of the first block */
+    uint64_t first;
+
+    /** Offset of the allocation the heap's users agreed to start from, or 0 */
+    uint64_t root;
+
+    /** Blocks currently allocated */
+    uint64_t allocations;
+
+    /** Process-shared, robust lock protecting the block list */
+    pthread_mutex_t lock;
+};
+
+/**
+ * A process's handle on a persistent heap it has mapped.
+ */
+struct pheap {
+    /** Where the file is mapped in this process */
+    char *base;
+
+    /** Size of the mapping */
+    size_t size;
+
+    /** Open file, holding a shared flock() for as long as the heap is attached */
+    int fd;
+
+    /** Page map entry, so free() and realloc() recognize the heap's pointers */
+    struct mem_region *region;
+};
+
+/**
+ * Start of an ALLOCATOR_TRACE file. trace_records follow until the end of the file.
+ */
+struct trace_header {
+    /** TRACE_MAGIC */
+    char magic[8];
+
+    /** TRACE_VERSION */
+    uint32_t version;
+
+    /** sizeof(struct trace_record) */
+    uint32_t record_size;
+
+    /** Process that wrote the trace */
+    uint64_t pid;
+};
+
+/**
+ * One recorded call. Frees are recorded before they take effect and allocations after, so a pointer
+ * that's freed and handed out again always shows up in that order.
+ */
+struct trace_record {
+    /** Nanoseconds since tracing started */
+    uint64_t timestamp;
+
+    /** Pointer returned (allocations), or pointer freed */
+    uint64_t ptr;
+
+    /** realloc(): the old pointer. calloc(): nmemb. TRACE_ALIGNED: the alignment. */
+    uint64_t arg;
+
+    /** Requested size (per member for calloc()) */
+    uint64_t size;
+
+    /** Calling thread */
+    uint32_t tid;
+
+    /** enum trace_op */
+    uint32_t op;
+};
+
+#endif
@@ -0,0 +1,174 @@
+/**
+ * @file
+ *
+ * C++ allocation operators. Defining the whole operator new/delete family here means C++ code
+ * reaches our allocator directly instead of going through libstdc++'s malloc() calls, and that
+ * the size passed to sized delete and the alignment passed to std::align_val_t new aren't lost
+ * on the way.
+ */
+
+#include <cstddef>
+#include <new>
+
+extern "C" {
+void *malloc(size_t size) noexcept;
+void free(void *ptr) noexcept;
+void *aligned_alloc(size_t alignment, size_t size) noexcept;
+void free_sized(void *ptr, size_t size) noexcept;
+void free_aligned_sized(void *ptr, size_t alignment, size_t size) noexcept;
+}
+
+namespace {
+
+/**
+ * @brief      Allocates like malloc()/aligned_alloc(), but follows the operator new contract: a
+ *              zero-byte request still gets a unique pointer, and on failure the installed new
+ *              handler is called until it either frees up memory or gives up.
+ *
+ * @param[in]  size       requested size
+ * @param[in]  alignment  requested alignment, or 0 for the default
+ *
+ * @return     allocated memory, or nullptr if there is no new handler left to try
+ */
+void *allocate_or_handle(std::size_t size, std::size_t alignment) noexcept
+{
+    if (size == 0) {
+        size = 1;
+    }
+
+    while (true) {
+        void *ptr = alignment == 0 ? malloc(size) : aligned_alloc(alignment, size);
+
+        if (ptr != nullptr) {
+            return ptr;
+        }
+
+        std::new_handler handler = std::get_new_handler();
+
+        if (handler == nullptr) {
+            return nullptr;
+        }
+
+        handler();
+    }
+}
+
+/**
+ * @brief      Throwing version of allocate_or_handle()
+ */
+void *allocate_or_throw(std::size_t size, std::size_t alignment)
+{
+    void *ptr = allocate_or_handle(size, alignment);
+
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    return ptr;
+}
+
+} // namespace
+
+/* -- operator new -- */
+
+void *operator new(std::size_t size)
+{
+    return allocate_or_throw(size, 0);
+}
+
+void *operator new[](std::size_t size)
+{
+    return allocate_or_throw(size, 0);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    return allocate_or_handle(size, 0);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return allocate_or_handle(size, 0);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    return allocate_or_throw(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return allocate_or_throw(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return allocate_or_handle(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return allocate_or_handle(size, static_cast<std::size_t>(alignment));
+}
+
+/* -- operator delete -- */
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t size) noexcept
+{
+    free_sized(ptr, size);
+}
+
+void operator delete[](void *ptr, std::size_t size) noexcept
+{
+    free_sized(ptr, size);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t size, std::align_val_t alignment) noexcept
+{
+    free_aligned_sized(ptr, static_cast<std::size_t>(alignment), size);
+}
+
+void operator delete[](void *ptr, std::size_t size, std::align_val_t alignment) noexcept
+{
+    free_aligned_sized(ptr, static_cast<std::size_t>(alignment), size);
+}
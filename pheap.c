@@ -0,0 +1,477 @@
+/**
+ * @file
+ *
+ * Persistent heap: a heap that lives in a file mapped MAP_SHARED instead of in anonymous memory.
+ * Blocks point to each other by offset from the start of the file, so the heap works wherever the
+ * file happens to be mapped. A process can restart and reattach to the heap exactly as it left it,
+ * and cooperating processes can map the same file and pass each other offsets (pheap_offset() /
+ * pheap_pointer()) to share structures without copying them.
+ *
+ * Usage:
+ *   struct pheap *heap = pheap_open("/dev/shm/cache", 64 << 20);
+ *   struct table *table = pheap_get_root(heap);
+ *   if (table == NULL) {
+ *       table = pheap_alloc(heap, sizeof(struct table));
+ *       pheap_set_root(heap, table);
+ *   }
+ *
+ * Anything stored inside the heap must refer to other allocations by offset, not by pointer.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "logger.h"
+
+/* Offset of the first block: right after the superblock, rounded up to PHEAP_ALIGN */
+#define PHEAP_DATA_OFFSET \
+    ((sizeof(struct pheap_super) + PHEAP_ALIGN - 1) & ~(uint64_t) (PHEAP_ALIGN - 1))
+
+/* Smallest block worth splitting off: a header and one aligned unit of data */
+#define PHEAP_MIN_BLOCK (sizeof(struct pheap_block) + PHEAP_ALIGN)
+
+/**
+ * @brief      Gets the superblock at the start of the heap
+ *
+ * @param      heap  heap
+ *
+ * @return     superblock
+ */
+static struct pheap_super *get_super(struct pheap *heap)
+{
+    return (struct pheap_super *) heap->base;
+}
+
+/**
+ * @brief      Turns a block offset into a header
+ *
+ * @param      heap    heap
+ * @param[in]  offset  offset of the block from the start of the file
+ *
+ * @return     block header, or NULL if offset is 0
+ */
+static struct pheap_block *get_block(struct pheap *heap, uint64_t offset)
+{
+    return offset != 0 ? (struct pheap_block *) (heap->base + offset) : NULL;
+}
+
+/**
+ * @brief      Turns a block header into its offset
+ *
+ * @param      heap   heap
+ * @param      block  block header (may be NULL)
+ *
+ * @return     offset of the block from the start of the file, or 0 for NULL
+ */
+static uint64_t get_block_offset(struct pheap *heap, struct pheap_block *block)
+{
+    return block != NULL ? (uint64_t) ((char *) block - heap->base) : 0;
+}
+
+/**
+ * @brief      Takes the heap's lock. If a process died holding it, the lock is recovered, but the
+ *              block list may have been left half-updated, so that's reported.
+ *
+ * @param      heap  heap
+ */
+static void pheap_lock(struct pheap *heap)
+{
+    struct pheap_super *super = get_super(heap);
+
+    if (pthread_mutex_lock(&super->lock) == EOWNERDEAD) {
+        report_error("pheap: a process died while holding the heap lock; the heap may be inconsistent\n");
+        pthread_mutex_consistent(&super->lock);
+    }
+}
+
+/**
+ * @brief      Releases the heap's lock
+ *
+ * @param      heap  heap
+ */
+static void pheap_unlock(struct pheap *heap)
+{
+    pthread_mutex_unlock(&get_super(heap)->lock);
+}
+
+/**
+ * @brief      Initializes the lock in the superblock as process-shared and robust
+ *
+ * @param      super  superblock
+ *
+ * @return     true on success
+ */
+static bool init_pheap_lock(struct pheap_super *super)
+{
+    pthread_mutexattr_t attr;
+
+    if (pthread_mutexattr_init(&attr) != 0) {
+        return false;
+    }
+
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+
+    bool ok = pthread_mutex_init(&super->lock, &attr) == 0;
+
+    pthread_mutexattr_destroy(&attr);
+    return ok;
+}
+
+/**
+ * @brief      Lays out a new heap: the superblock, then one free block covering the rest of the file
+ *
+ * @param      heap  heap, mapped over a zero-filled file
+ */
+static void init_pheap_layout(struct pheap *heap)
+{
+    struct pheap_super *super = get_super(heap);
+
+    super->version = PHEAP_VERSION;
+    super->block_size = sizeof(struct pheap_block);
+    super->size = heap->size;
+    super->first = PHEAP_DATA_OFFSET;
+    super->root = 0;
+    super->allocations = 0;
+
+    struct pheap_block *first = get_block(heap, super->first);
+
+    first->size = heap->size - PHEAP_DATA_OFFSET;
+    first->next = 0;
+    first->prev = 0;
+    first->magic = BLOCK_MAGIC;
+    first->free = 1;
+
+    // Written last: a file only counts as a heap once it's fully laid out
+    memcpy(super->magic, PHEAP_MAGIC, sizeof(super->magic));
+}
+
+/**
+ * @brief      Checks that an existing file is a persistent heap this code can use
+ *
+ * @param      super  superblock of the mapped file
+ * @param[in]  size   size of the file
+ *
+ * @return     true if the layout matches
+ */
+static bool pheap_layout_is_valid(struct pheap_super *super, size_t size)
+{
+    return memcmp(super->magic, PHEAP_MAGIC, sizeof(super->magic)) == 0
+        && super->version == PHEAP_VERSION
+        && super->block_size == sizeof(struct pheap_block)
+        && super->size == size
+        && super->first == PHEAP_DATA_OFFSET;
+}
+
+/**
+ * @brief      Opens (or creates) a persistent heap file and maps it. A new file is sized to size and
+ *              laid out as one free block; an existing one is attached as it is, and size is
+ *              ignored.
+ *
+ *              Each process holds a shared flock() on the file while attached. A process that can
+ *              get the lock exclusively is the only one attached, so nobody can be holding the
+ *              heap's mutex, and it reinitializes it (a mutex left in the file by a process that
+ *              has since exited would otherwise stay locked forever).
+ *
+ * @param[in]  path  file to use, e.g. under /dev/shm for sharing without disk writes
+ * @param[in]  size  size for a new heap, in bytes (rounded up to whole pages)
+ *
+ * @return     heap handle, or NULL with errno set
+ */
+struct pheap *pheap_open(const char *path, size_t size)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    bool alone = flock(fd, LOCK_EX | LOCK_NB) == 0;
+
+    if (!alone && flock(fd, LOCK_SH) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    bool fresh = st.st_size == 0;
+    size_t map_size = st.st_size;
+
+    if (fresh) {
+        // Case: another process is attached to an empty file - it must have failed to set it up
+        if (!alone || size > SIZE_MAX - PHEAP_DATA_OFFSET - PHEAP_MIN_BLOCK) {
+            close(fd);
+            errno = EINVAL;
+            return NULL;
+        }
+
+        map_size = get_region_size(size + PHEAP_DATA_OFFSET + PHEAP_MIN_BLOCK);
+
+        if (ftruncate(fd, map_size) != 0) {
+            close(fd);
+            return NULL;
+        }
+    }
+
+    void *base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    struct pheap *heap = malloc(sizeof(struct pheap));
+
+    if (heap == NULL) {
+        munmap(base, map_size);
+        close(fd);
+        return NULL;
+    }
+
+    heap->base = base;
+    heap->size = map_size;
+    heap->fd = fd;
+
+    if (fresh) {
+        init_pheap_layout(heap);
+    }
+    else if (!pheap_layout_is_valid(get_super(heap), map_size)) {
+        munmap(base, map_size);
+        close(fd);
+        free(heap);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (alone) {
+        if (!init_pheap_lock(get_super(heap))) {
+            munmap(base, map_size);
+            close(fd);
+            free(heap);
+            errno = ENOLCK;
+            return NULL;
+        }
+
+        flock(fd, LOCK_SH);
+    }
+
+    // Not fatal if this fails: free() just won't be able to tell the heap's pointers apart
+    heap->region = adopt_mapping(base, map_size, REGION_PERSISTENT);
+
+    return heap;
+}
+
+/**
+ * @brief      Unmaps a persistent heap. The file, and everything allocated in it, stays as it is.
+ *
+ * @param      heap  heap (may be NULL)
+ */
+void pheap_close(struct pheap *heap)
+{
+    if (heap == NULL) {
+        return;
+    }
+
+    drop_mapping(heap->region);
+    munmap(heap->base, heap->size);
+    close(heap->fd); // Also drops our flock()
+    free(heap);
+}
+
+/**
+ * @brief      Allocates from a persistent heap (first fit over the block list)
+ *
+ * @param      heap  heap
+ * @param[in]  size  requested size
+ *
+ * @return     data block aligned to PHEAP_ALIGN, or NULL if the heap is full
+ */
+void *pheap_alloc(struct pheap *heap, size_t size)
+{
+    if (size > heap->size) {
+        return NULL;
+    }
+
+    uint64_t real_size = (size + sizeof(struct pheap_block) + PHEAP_ALIGN - 1)
+        & ~(uint64_t) (PHEAP_ALIGN - 1);
+
+    pheap_lock(heap);
+
+    struct pheap_super *super = get_super(heap);
+    struct pheap_block *block = get_block(heap, super->first);
+
+    while (block != NULL && !(block->free && block->size >= real_size)) {
+        block = get_block(heap, block->next);
+    }
+
+    if (block == NULL) {
+        pheap_unlock(heap);
+        return NULL;
+    }
+
+    // Case: enough left over to stand as a block - split it off
+    if (block->size - real_size >= PHEAP_MIN_BLOCK) {
+        struct pheap_block *leftover = (struct pheap_block *) ((char *) block + real_size);
+
+        leftover->size = block->size - real_size;
+        leftover->prev = get_block_offset(heap, block);
+        leftover->next = block->next;
+        leftover->magic = BLOCK_MAGIC;
+        leftover->free = 1;
+
+        if (leftover->next != 0) {
+            get_block(heap, leftover->next)->prev = get_block_offset(heap, leftover);
+        }
+
+        block->size = real_size;
+        block->next = get_block_offset(heap, leftover);
+    }
+
+    block->free = 0;
+    super->allocations++;
+
+    pheap_unlock(heap);
+
+    return block + 1;
+}
+
+/**
+ * @brief      Absorbs the block after block into it. Both must be free.
+ *
+ * @param      heap   heap
+ * @param      block  block whose next neighbor is absorbed
+ */
+static void pheap_absorb_next(struct pheap *heap, struct pheap_block *block)
+{
+    struct pheap_block *next = get_block(heap, block->next);
+
+    block->size += next->size;
+    block->next = next->next;
+
+    if (block->next != 0) {
+        get_block(heap, block->next)->prev = get_block_offset(heap, block);
+    }
+
+    next->magic = 0;
+}
+
+/**
+ * @brief      Frees an allocation from a persistent heap and merges it with free neighbors
+ *
+ * @param      heap  heap
+ * @param      ptr   pointer returned by pheap_alloc() on this heap, in any process (may be NULL)
+ */
+void pheap_free(struct pheap *heap, void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+    struct pheap_block *block = (struct pheap_block *) ptr - 1;
+
+    pheap_lock(heap);
+
+    // Case: not the start of a live allocation in this heap - leave the heap alone
+    if ((char *) block < heap->base + PHEAP_DATA_OFFSET || (char *) ptr >= heap->base + heap->size
+            || block->magic != BLOCK_MAGIC || block->free) {
+        pheap_unlock(heap);
+        report_error("pheap_free(): invalid pointer %p\n", ptr);
+        return;
+    }
+
+    block->free = 1;
+    get_super(heap)->allocations--;
+
+    struct pheap_block *next = get_block(heap, block->next);
+    struct pheap_block *prev = get_block(heap, block->prev);
+
+    if (next != NULL && next->free) {
+        pheap_absorb_next(heap, block);
+    }
+
+    if (prev != NULL && prev->free) {
+        pheap_absorb_next(heap, prev);
+    }
+
+    pheap_unlock(heap);
+}
+
+/**
+ * @brief      Turns a pointer into the heap into an offset that means the same thing in every
+ *              process mapping it
+ *
+ * @param      heap  heap
+ * @param      ptr   pointer into the heap (may be NULL)
+ *
+ * @return     offset from the start of the file, or 0 for NULL
+ */
+uint64_t pheap_offset(struct pheap *heap, void *ptr)
+{
+    return ptr != NULL ? (uint64_t) ((char *) ptr - heap->base) : 0;
+}
+
+/**
+ * @brief      Turns an offset from pheap_offset() back into a pointer in this process
+ *
+ * @param      heap    heap
+ * @param[in]  offset  offset from the start of the file
+ *
+ * @return     pointer, or NULL if offset is 0 or past the end of the heap
+ */
+void *pheap_pointer(struct pheap *heap, uint64_t offset)
+{
+    return offset != 0 && offset < heap->size ? heap->base + offset : NULL;
+}
+
+/**
+ * @brief      Gets the heap's root allocation: the one its users find everything else from after
+ *              attaching
+ *
+ * @param      heap  heap
+ *
+ * @return     root allocation, or NULL if none has been set
+ */
+void *pheap_get_root(struct pheap *heap)
+{
+    return pheap_pointer(heap, __atomic_load_n(&get_super(heap)->root, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * @brief      Sets the heap's root allocation
+ *
+ * @param      heap  heap
+ * @param      ptr   allocation from this heap, or NULL to clear the root
+ */
+void pheap_set_root(struct pheap *heap, void *ptr)
+{
+    __atomic_store_n(&get_super(heap)->root, pheap_offset(heap, ptr), __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief      Writes the heap's pages back to its file, so they survive a crash of the machine (not
+ *              just of the process, which MAP_SHARED already covers)
+ *
+ * @param      heap  heap
+ *
+ * @return     0 on success, -1 with errno set on failure
+ */
+int pheap_sync(struct pheap *heap)
+{
+    return msync(heap->base, heap->size, MS_SYNC);
+}
@@ -0,0 +1,613 @@
+/**
+ * @file
+ *
+ * Replays an allocation trace recorded with ALLOCATOR_TRACE against each allocator policy and
+ * reports how they compare on it.
+ *
+ * To use:
+ * ALLOCATOR_TRACE=/tmp/service.trace LD_PRELOAD=$(pwd)/allocator.so command
+ * ./replay /tmp/service.trace
+ * ./replay -p best_fit,adaptive -l $(pwd)/allocator.so /tmp/service.trace
+ *
+ * The trace is first turned into a list of operations on numbered slots (pointer values only mean
+ * something inside the traced process). Each policy then runs in a fresh process, started with the
+ * allocator preloaded and ALLOCATOR_ALGORITHM set, which replays the operations on one thread in
+ * recorded order. Every run therefore makes exactly the same calls.
+ */
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "allocator.h"
+
+/* Slot number meaning "no allocation" */
+#define NO_SLOT UINT32_MAX
+
+/**
+ * One call to replay. Slots stand in for the pointers in the trace; a slot is reused once the
+ * allocation in it has been freed, so the number of slots is the peak number of live allocations.
+ */
+struct replay_op {
+    /** enum trace_op */
+    uint32_t op;
+
+    /** Slot the result goes into (allocations), or slot being freed */
+    uint32_t slot;
+
+    /** realloc(): slot holding the old pointer, or NO_SLOT for realloc(NULL, ...) */
+    uint32_t old_slot;
+
+    uint32_t padding;
+
+    /** Requested size (per member for calloc()) */
+    uint64_t size;
+
+    /** calloc(): nmemb. TRACE_ALIGNED: the alignment. */
+    uint64_t arg;
+};
+
+/**
+ * Start of the file the parent hands to each replaying child; replay_ops follow.
+ */
+struct replay_plan {
+    /** Number of replay_ops */
+    uint64_t count;
+
+    /** Number of slots needed */
+    uint64_t slots;
+
+    /** Index of the operation after which the most requested bytes are live */
+    uint64_t peak_index;
+
+    /** Requested bytes live at that point */
+    uint64_t peak_bytes;
+};
+
+/**
+ * Pointer-to-slot table used while building the plan (open addressing, linear probing)
+ */
+struct slot_table {
+    uint64_t *keys;
+    uint32_t *slots;
+    size_t capacity;
+    size_t used;
+};
+
+/**
+ * @brief      Hashes a pointer value for the slot table
+ *
+ * @param[in]  key  pointer value from the trace
+ *
+ * @return     hash
+ */
+static size_t hash_pointer(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+}
+
+/**
+ * @brief      Finds where key is, or would go, in the table
+ *
+ * @param      table  table
+ * @param[in]  key    pointer value (never 0)
+ *
+ * @return     index of key's entry, or of the empty entry where it belongs
+ */
+static size_t find_entry(struct slot_table *table, uint64_t key)
+{
+    size_t index = hash_pointer(key) & (table->capacity - 1);
+
+    while (table->keys[index] != 0 && table->keys[index] != key) {
+        index = (index + 1) & (table->capacity - 1);
+    }
+
+    return index;
+}
+
+/**
+ * @brief      Records that key now lives in slot, growing the table if it's getting full
+ *
+ * @param      table  table
+ * @param[in]  key    pointer value (never 0)
+ * @param[in]  slot   slot
+ */
+static void put_slot(struct slot_table *table, uint64_t key, uint32_t slot)
+{
+    if ((table->used + 1) * 2 > table->capacity) {
+        struct slot_table bigger = {
+            .capacity = table->capacity * 2,
+        };
+        bigger.keys = calloc(bigger.capacity, sizeof(uint64_t));
+        bigger.slots = calloc(bigger.capacity, sizeof(uint32_t));
+
+        if (bigger.keys == NULL || bigger.slots == NULL) {
+            perror("replay");
+            exit(1);
+        }
+
+        for (size_t i = 0; i < table->capacity; i++) {
+            if (table->keys[i] != 0 && table->slots[i] != NO_SLOT) {
+                size_t index = find_entry(&bigger, table->keys[i]);
+                bigger.keys[index] = table->keys[i];
+                bigger.slots[index] = table->slots[i];
+                bigger.used++;
+            }
+        }
+
+        free(table->keys);
+        free(table->slots);
+        *table = bigger;
+    }
+
+    size_t index = find_entry(table, key);
+
+    if (table->keys[index] == 0) {
+        table->keys[index] = key;
+        table->used++;
+    }
+    table->slots[index] = slot;
+}
+
+/**
+ * @brief      Looks up and forgets the slot key lives in. The entry stays behind as a tombstone
+ *              (NO_SLOT) so later probes still find what's past it.
+ *
+ * @param      table  table
+ * @param[in]  key    pointer value
+ *
+ * @return     slot, or NO_SLOT if key isn't live (e.g. it was allocated before tracing started)
+ */
+static uint32_t take_slot(struct slot_table *table, uint64_t key)
+{
+    if (key == 0) {
+        return NO_SLOT;
+    }
+
+    size_t index = find_entry(table, key);
+
+    if (table->keys[index] == 0) {
+        return NO_SLOT;
+    }
+
+    uint32_t slot = table->slots[index];
+    table->slots[index] = NO_SLOT;
+    return slot;
+}
+
+/**
+ * @brief      Turns a trace into a replay plan, written to a memfd the children can map. Frees of
+ *              pointers the trace never saw allocated are dropped; so are failed allocations.
+ *
+ * @param[in]  path  trace file
+ *
+ * @return     file descriptor of the plan
+ */
+static int build_plan(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(path);
+        exit(1);
+    }
+
+    if ((size_t) st.st_size < sizeof(struct trace_header)) {
+        fprintf(stderr, "%s: not a trace\n", path);
+        exit(1);
+    }
+
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    struct trace_header *header = (struct trace_header *) data;
+
+    if (data == MAP_FAILED || memcmp(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0
+            || header->version != TRACE_VERSION || header->record_size != sizeof(struct trace_record)) {
+        fprintf(stderr, "%s: not a version %d trace\n", path, TRACE_VERSION);
+        exit(1);
+    }
+
+    struct trace_record *records = (struct trace_record *) (header + 1);
+    size_t record_count = (st.st_size - sizeof(struct trace_header)) / sizeof(struct trace_record);
+
+    int plan_fd = memfd_create("replay-plan", 0);
+    size_t plan_size = sizeof(struct replay_plan) + record_count * sizeof(struct replay_op);
+
+    if (plan_fd < 0 || ftruncate(plan_fd, plan_size) != 0) {
+        perror("replay");
+        exit(1);
+    }
+
+    struct replay_plan *plan = mmap(NULL, plan_size, PROT_READ | PROT_WRITE, MAP_SHARED, plan_fd, 0);
+
+    if (plan == MAP_FAILED) {
+        perror("replay");
+        exit(1);
+    }
+
+    struct replay_op *ops = (struct replay_op *) (plan + 1);
+    struct slot_table table = { .capacity = 1024 };
+    table.keys = calloc(table.capacity, sizeof(uint64_t));
+    table.slots = calloc(table.capacity, sizeof(uint32_t));
+
+    // Slots freed so far, reused most recent first; sized as the records go
+    uint32_t *free_slots = NULL;
+    size_t free_count = 0;
+    uint64_t *slot_bytes = NULL;
+    size_t slot_capacity = 0;
+    uint32_t slots = 0;
+
+    uint64_t live_bytes = 0;
+    size_t count = 0;
+
+    for (size_t i = 0; i < record_count; i++) {
+        struct trace_record *record = &records[i];
+        struct replay_op op = { .op = record->op, .slot = NO_SLOT, .old_slot = NO_SLOT,
+            .size = record->size, .arg = record->arg };
+
+        if (record->op == TRACE_FREE || record->op == TRACE_REALLOC) {
+            uint64_t freed = record->op == TRACE_FREE ? record->ptr : record->arg;
+            uint32_t slot = take_slot(&table, freed);
+
+            if (slot != NO_SLOT) {
+                live_bytes -= slot_bytes[slot];
+                free_slots[free_count++] = slot;
+            }
+
+            if (record->op == TRACE_FREE) {
+                if (slot == NO_SLOT) {
+                    continue;
+                }
+                op.slot = slot;
+                ops[count++] = op;
+                continue;
+            }
+
+            op.old_slot = slot;
+            op.arg = 0;
+
+            // Case: realloc() of something we never saw allocated - replay it as an allocation
+            if (slot == NO_SLOT && record->arg != 0) {
+                op.op = TRACE_MALLOC;
+            }
+        }
+
+        // Case: realloc(ptr, 0) or a failed allocation - nothing new is live
+        if (record->ptr == 0) {
+            if (op.old_slot != NO_SLOT) {
+                ops[count++] = op;
+            }
+            continue;
+        }
+
+        uint32_t slot = free_count > 0 ? free_slots[--free_count] : slots++;
+
+        if (slot >= slot_capacity) {
+            slot_capacity = slot_capacity == 0 ? 1024 : slot_capacity * 2;
+            slot_bytes = realloc(slot_bytes, slot_capacity * sizeof(uint64_t));
+            free_slots = realloc(free_slots, slot_capacity * sizeof(uint32_t));
+
+            if (slot_bytes == NULL || free_slots == NULL) {
+                perror("replay");
+                exit(1);
+            }
+        }
+
+        slot_bytes[slot] = record->op == TRACE_CALLOC ? record->arg * record->size : record->size;
+        live_bytes += slot_bytes[slot];
+        put_slot(&table, record->ptr, slot);
+
+        op.slot = slot;
+        ops[count++] = op;
+
+        if (live_bytes > plan->peak_bytes) {
+            plan->peak_bytes = live_bytes;
+            plan->peak_index = count - 1;
+        }
+    }
+
+    plan->count = count;
+    plan->slots = slots;
+
+    munmap(plan, plan_size);
+    munmap(data, st.st_size);
+    close(fd);
+    free(table.keys);
+    free(table.slots);
+    free(free_slots);
+    free(slot_bytes);
+
+    return plan_fd;
+}
+
+/**
+ * @brief      Gets CLOCK_MONOTONIC in seconds
+ *
+ * @return     current time
+ */
+static double now_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief      Measures the heap through the preloaded allocator's take_snapshot()
+ *
+ * @param      heap_bytes     where to store the bytes in all regions
+ * @param      fragmentation  where to store 1 - largest free block / free bytes
+ *
+ * @return     true if the allocator could be asked
+ */
+static bool measure_heap(uint64_t *heap_bytes, double *fragmentation)
+{
+    int (*take)(struct heap_snapshot *) = dlsym(RTLD_DEFAULT, "take_snapshot");
+    void (*release)(struct heap_snapshot *) = dlsym(RTLD_DEFAULT, "release_snapshot");
+    struct heap_snapshot snapshot;
+
+    if (take == NULL || release == NULL || take(&snapshot) != 0) {
+        return false;
+    }
+
+    uint64_t total = 0, free_bytes = 0, largest = 0;
+
+    for (size_t i = 0; i < snapshot.count; i++) {
+        struct block_record *record = &snapshot.records[i];
+
+        total += record->size;
+        if (record->free) {
+            free_bytes += record->size;
+            largest = record->size > largest ? record->size : largest;
+        }
+    }
+
+    release(&snapshot);
+
+    *heap_bytes = total;
+    *fragmentation = free_bytes > 0 ? 1.0 - (double) largest / free_bytes : 0.0;
+    return true;
+}
+
+/**
+ * @brief      Child side: replays the plan with whatever allocator is loaded and prints
+ *              "ops seconds heap_bytes fragmentation" (heap measured at the peak of live bytes)
+ *
+ * @param[in]  plan_fd  plan from build_plan()
+ *
+ * @return     exit status
+ */
+static int run_plan(int plan_fd)
+{
+    struct stat st;
+
+    if (fstat(plan_fd, &st) != 0) {
+        return 1;
+    }
+
+    struct replay_plan *plan = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, plan_fd, 0);
+
+    if (plan == MAP_FAILED) {
+        return 1;
+    }
+
+    struct replay_op *ops = (struct replay_op *) (plan + 1);
+    size_t slots_size = (plan->slots + 1) * sizeof(void *);
+    void **slots = mmap(NULL, slots_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (slots == MAP_FAILED) {
+        return 1;
+    }
+
+    // Touch the plan and slots up front so page faults on them aren't timed
+    volatile uint64_t sink = 0;
+    for (size_t i = 0; i < plan->count; i += 4096 / sizeof(struct replay_op)) {
+        sink += ops[i].size;
+    }
+    memset(slots, 0, slots_size);
+
+    uint64_t heap_bytes = 0;
+    double fragmentation = -1;
+    double elapsed = 0;
+    double start = now_seconds();
+
+    for (size_t i = 0; i < plan->count; i++) {
+        struct replay_op *op = &ops[i];
+
+        switch (op->op) {
+            case TRACE_MALLOC:
+                slots[op->slot] = malloc(op->size);
+                break;
+            case TRACE_FREE:
+                free(slots[op->slot]);
+                break;
+            case TRACE_CALLOC:
+                slots[op->slot] = calloc(op->arg, op->size);
+                break;
+            case TRACE_ALIGNED:
+                slots[op->slot] = aligned_alloc(op->arg, op->size);
+                break;
+            case TRACE_REALLOC: {
+                void *old = op->old_slot != NO_SLOT ? slots[op->old_slot] : NULL;
+                void *new_ptr = realloc(old, op->size);
+
+                if (op->slot != NO_SLOT) {
+                    slots[op->slot] = new_ptr;
+                }
+                break;
+            }
+        }
+
+        if (i == plan->peak_index) {
+            elapsed += now_seconds() - start;
+            if (!measure_heap(&heap_bytes, &fragmentation)) {
+                fragmentation = -1;
+            }
+            start = now_seconds();
+        }
+    }
+
+    elapsed += now_seconds() - start;
+
+    printf("%llu %.9f %llu %.6f\n", (unsigned long long) plan->count, elapsed,
+            (unsigned long long) heap_bytes, fragmentation);
+    return 0;
+}
+
+/**
+ * @brief      Parent side: replays the plan under one policy in a fresh process and prints a row
+ *
+ * @param[in]  exe        path to this program
+ * @param[in]  allocator  absolute path to allocator.so
+ * @param[in]  policy     ALLOCATOR_ALGORITHM value
+ * @param[in]  plan_fd    plan from build_plan()
+ * @param[in]  peak_bytes requested bytes live at the peak
+ */
+static void compare_policy(const char *exe, const char *allocator, const char *policy, int plan_fd,
+        uint64_t peak_bytes)
+{
+    int out[2];
+
+    if (pipe(out) != 0) {
+        perror("replay");
+        exit(1);
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        char fd_arg[16];
+        snprintf(fd_arg, sizeof(fd_arg), "%d", plan_fd);
+
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        close(out[1]);
+
+        setenv("LD_PRELOAD", allocator, 1);
+        setenv("ALLOCATOR_ALGORITHM", policy, 1);
+        unsetenv("ALLOCATOR_TRACE");
+
+        execl(exe, exe, "--run", fd_arg, (char *) NULL);
+        perror(exe);
+        _exit(127);
+    }
+
+    close(out[1]);
+
+    char result[256] = "";
+    ssize_t length = read(out[0], result, sizeof(result) - 1);
+    close(out[0]);
+
+    struct rusage usage;
+    int status;
+    wait4(pid, &status, 0, &usage);
+
+    unsigned long long ops, heap_bytes;
+    double seconds, fragmentation;
+
+    if (length <= 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0
+            || sscanf(result, "%llu %lf %llu %lf", &ops, &seconds, &heap_bytes, &fragmentation) != 4) {
+        printf("%-12s  replay failed\n", policy);
+        return;
+    }
+
+    printf("%-12s  %12.0f  %9.3f  %13.1f", policy, seconds > 0 ? ops / seconds : 0.0, seconds,
+            usage.ru_maxrss / 1024.0);
+
+    if (fragmentation < 0) {
+        printf("  %14s  %11s  %13s\n", "-", "-", "-");
+    }
+    else {
+        printf("  %14.1f  %10.1f%%  %13.4f\n", heap_bytes / 1048576.0,
+                heap_bytes > 0 ? 100.0 * peak_bytes / heap_bytes : 0.0, fragmentation);
+    }
+}
+
+/**
+ * @brief      Prints usage and exits
+ *
+ * @param[in]  name  program name
+ */
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-l allocator.so] [-p policy,policy,...] trace\n", name);
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 3 && strcmp(argv[1], "--run") == 0) {
+        return run_plan(atoi(argv[2]));
+    }
+
+    const char *allocator = "./allocator.so";
+    char default_policies[] = "first_fit,best_fit,worst_fit,adaptive";
+    char *policies = default_policies;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:p:")) != -1) {
+        switch (opt) {
+            case 'l':
+                allocator = optarg;
+                break;
+            case 'p':
+                policies = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+
+    char allocator_path[PATH_MAX];
+    char exe[PATH_MAX];
+    ssize_t exe_length = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+
+    if (realpath(allocator, allocator_path) == NULL || exe_length < 0) {
+        perror(allocator);
+        return 1;
+    }
+    exe[exe_length] = '\0';
+
+    int plan_fd = build_plan(argv[optind]);
+    struct replay_plan plan;
+
+    if (pread(plan_fd, &plan, sizeof(plan), 0) != sizeof(plan)) {
+        perror("replay");
+        return 1;
+    }
+
+    printf("%llu operations, %llu live allocations at most, %.1f MiB requested at peak\n\n",
+            (unsigned long long) plan.count, (unsigned long long) plan.slots,
+            plan.peak_bytes / 1048576.0);
+    printf("%-12s  %12s  %9s  %13s  %14s  %11s  %13s\n", "policy", "ops/s", "time (s)",
+            "peak RSS MiB", "heap@peak MiB", "utilization", "fragmentation");
+    fflush(stdout);
+
+    for (char *policy = strtok(policies, ","); policy != NULL; policy = strtok(NULL, ",")) {
+        compare_policy(exe, allocator_path, policy, plan_fd, plan.peak_bytes);
+        fflush(stdout);
+    }
+
+    return 0;
+}